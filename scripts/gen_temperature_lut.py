@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Generate the piecewise-linear temperature lookup table.
+
+The table maps the voltage measured on the temperature channel to signed
+centi-degrees Celsius. Entries are evenly spaced by a power of two
+millivolts, so the firmware finds the segment of a reading with a shift and
+interpolates it with integer arithmetic only.
+"""
+
+import argparse
+import math
+
+KELVIN = 273.15
+# Readings outside of this range are clamped
+MIN_CENTI_C = -5500
+MAX_CENTI_C = 15000
+
+
+def tmp36(mv, args):
+    return (mv - args.tmp36_offset_mv) * 1000 / args.tmp36_uv_per_c
+
+
+def resistance(mv, args):
+    """Thermistor resistance in ohms, or None when the divider saturates."""
+    supply = args.supply_mv
+    if mv <= 0 or mv >= supply:
+        return None
+    if args.high_side:
+        # Thermistor between the supply and the ADC input
+        return args.series_r * (supply - mv) / mv
+    # Thermistor between the ADC input and ground
+    return args.series_r * mv / (supply - mv)
+
+
+def ntc(mv, args):
+    r = resistance(mv, args)
+    if r is None:
+        return None
+    inv_t = 1 / (25 + KELVIN) + math.log(r / args.r25) / args.beta
+    return 1 / inv_t - KELVIN
+
+
+def steinhart_hart(mv, args):
+    r = resistance(mv, args)
+    if r is None:
+        return None
+    ln_r = math.log(r)
+    inv_t = args.sh_a + args.sh_b * ln_r + args.sh_c * ln_r**3
+    return 1 / inv_t - KELVIN
+
+
+FRONTENDS = {
+    "tmp36": tmp36,
+    "ntc": ntc,
+    "thermistor": steinhart_hart,
+}
+
+
+def centi_degrees(mv, args, previous):
+    celsius = FRONTENDS[args.frontend](mv, args)
+    if celsius is None:
+        # Saturated divider: hold the value of the neighbouring entry
+        return previous
+    return max(MIN_CENTI_C, min(MAX_CENTI_C, round(celsius * 100)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--frontend", choices=FRONTENDS, required=True)
+    parser.add_argument("--max-mv", type=int, required=True)
+    parser.add_argument("--step-shift", type=int, required=True)
+    parser.add_argument("--tmp36-offset-mv", type=int, default=500)
+    parser.add_argument("--tmp36-uv-per-c", type=int, default=10000)
+    parser.add_argument("--supply-mv", type=int, default=3000)
+    parser.add_argument("--series-r", type=int, default=10000)
+    parser.add_argument("--high-side", action="store_true")
+    parser.add_argument("--r25", type=int, default=10000)
+    parser.add_argument("--beta", type=int, default=3950)
+    parser.add_argument("--sh-a", type=float, default=0.0)
+    parser.add_argument("--sh-b", type=float, default=0.0)
+    parser.add_argument("--sh-c", type=float, default=0.0)
+    parser.add_argument("--output", required=True)
+    args = parser.parse_args()
+
+    step = 1 << args.step_shift
+    count = args.max_mv // step + 2
+
+    entries = [None] * count
+    previous = None
+    for i in range(count):
+        entries[i] = centi_degrees(i * step, args, previous)
+        previous = entries[i]
+    # Entries saturated before the first valid one take its value
+    first = next(e for e in entries if e is not None)
+    entries = [first if e is None else e for e in entries]
+
+    with open(args.output, "w", encoding="utf-8") as out:
+        out.write("/* Generated by scripts/gen_temperature_lut.py, do not edit */\n")
+        out.write("#ifndef TEMPERATURE_LUT_H\n#define TEMPERATURE_LUT_H\n\n")
+        out.write("#include <stdint.h>\n\n")
+        out.write(f"#define TEMPERATURE_LUT_STEP_SHIFT {args.step_shift}\n")
+        out.write(f"#define TEMPERATURE_LUT_SIZE {count}\n\n")
+        out.write("/* Centi-degrees Celsius at i << TEMPERATURE_LUT_STEP_SHIFT mV */\n")
+        out.write("static const int16_t temperature_lut[TEMPERATURE_LUT_SIZE] = {\n")
+        for i in range(0, count, 8):
+            row = ", ".join(str(e) for e in entries[i : i + 8])
+            out.write(f"\t{row},\n")
+        out.write("};\n\n#endif\n")
+
+
+if __name__ == "__main__":
+    main()
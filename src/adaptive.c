@@ -0,0 +1,342 @@
+#include "adaptive.h"
+#include "ble.h"
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/sys/byteorder.h>
+
+LOG_MODULE_REGISTER(adaptive, LOG_LEVEL_INF);
+
+#define ADAPTIVE_SUBTREE     "adaptive"
+#define ADAPTIVE_BOUNDS_NAME "bounds"
+
+/* Bounds as read and written on the sampling bounds characteristic */
+#define ADAPTIVE_BOUNDS_SIZE 6
+
+static ssize_t read_bounds(struct bt_conn *conn,
+			   const struct bt_gatt_attr *attr, void *buf,
+			   uint16_t len, uint16_t offset);
+static ssize_t write_bounds(struct bt_conn *conn,
+			    const struct bt_gatt_attr *attr, const void *buf,
+			    uint16_t len, uint16_t offset, uint8_t flags);
+static void save_bounds(struct k_work *work);
+
+BT_GATT_SERVICE_DEFINE(sampling_svc,
+		       BT_GATT_PRIMARY_SERVICE(BT_UUID_SAMPLING_SVC),
+		       BT_GATT_CHARACTERISTIC(BT_UUID_SAMPLING_BOUNDS,
+					      BT_GATT_CHRC_READ |
+						      BT_GATT_CHRC_WRITE,
+					      BT_GATT_PERM_READ |
+						      BT_GATT_PERM_WRITE,
+					      read_bounds, write_bounds, NULL));
+
+K_WORK_DEFINE(save_work, save_bounds);
+
+static struct k_spinlock lock;
+static adaptive_bounds_t bounds = {
+	.min_period = CONFIG_LIONK_SAMPLING_MIN_PERIOD,
+	.max_period = CONFIG_LIONK_SAMPLING_MAX_PERIOD,
+	.threshold = CONFIG_LIONK_SAMPLING_THRESHOLD,
+};
+static uint32_t period = CONFIG_LIONK_SAMPLING_MIN_PERIOD;
+static uint16_t override; // Period set by adaptive_set_override(), or 0
+static adaptive_period_cb_t period_cb;
+
+/* Only accessed from the system work queue */
+static bool has_last;
+static int16_t last_temperature;
+
+/**
+ * @brief Checks that bounds can be applied
+ * 
+ * @param new_bounds Bounds to check
+ * @return true if the bounds are valid, false otherwise
+ */
+static bool bounds_valid(const adaptive_bounds_t *new_bounds)
+{
+	return new_bounds->min_period > 0 &&
+	       new_bounds->min_period <= new_bounds->max_period;
+}
+
+/**
+ * @brief Writes the current bounds to settings
+ * 
+ * Runs on the system work queue, so a write from a Bluetooth callback does
+ * not wait for flash.
+ * 
+ * @param work Pointer to the work structure (unused)
+ */
+static void save_bounds(struct k_work *work)
+{
+	adaptive_bounds_t saved;
+
+	(void)work;
+	adaptive_get_bounds(&saved);
+
+	int err = settings_save_one(ADAPTIVE_SUBTREE "/" ADAPTIVE_BOUNDS_NAME,
+				    &saved, sizeof(saved));
+	if (err) {
+		LOG_ERR("Couldn't save sampling bounds (%d)", err);
+	}
+}
+
+/**
+ * @brief Initializes the adaptive sampling period
+ * 
+ * The bounds are loaded from settings along with the Bluetooth settings,
+ * so this must be called after ble_setup(). The sampling period starts at
+ * the minimum period.
+ * 
+ * @param cb Callback invoked when the sampling period changes
+ * @return Initial sampling period in seconds
+ */
+uint32_t adaptive_init(adaptive_period_cb_t cb)
+{
+	uint32_t initial;
+
+	K_SPINLOCK(&lock) {
+		period_cb = cb;
+		period = bounds.min_period;
+		initial = period;
+	}
+	LOG_INF("Sampling period between %u and %u s, threshold %u",
+		bounds.min_period, bounds.max_period, bounds.threshold);
+	return initial;
+}
+
+/**
+ * @brief Adapts the sampling period to a new temperature sample
+ * 
+ * While the temperature changes by no more than the threshold between two
+ * samples, the period doubles up to the maximum period. As soon as it
+ * changes by more, the period snaps back to the minimum period. Since the
+ * change is measured over the period, a slow drift also brings the period
+ * back down before it grows too long. While an override is set, the period
+ * stays at the override. Called from the system work queue.
+ * 
+ * @param temperature Temperature of the sample
+ */
+void adaptive_update(int16_t temperature)
+{
+	bool changed = false;
+	uint32_t next;
+
+	K_SPINLOCK(&lock) {
+		if (override) {
+			next = override;
+		} else if (has_last &&
+		    abs(temperature - last_temperature) <= bounds.threshold) {
+			next = MIN(period * 2, bounds.max_period);
+		} else {
+			next = bounds.min_period;
+		}
+		changed = next != period;
+		period = next;
+	}
+	has_last = true;
+	last_temperature = temperature;
+
+	if (changed) {
+		LOG_INF("Sampling period %u s", next);
+		if (period_cb) {
+			period_cb(next);
+		}
+	}
+}
+
+/**
+ * @brief Changes and persists the bounds of the sampling period
+ * 
+ * The sampling period restarts at the new minimum period, or at the
+ * override if one is set. Bounds equal to the current ones are ignored, so
+ * writing them again neither wears the flash nor postpones the next sample.
+ * 
+ * @param new_bounds New bounds
+ * @return 0 on success, -EINVAL if the minimum period is 0 or greater than
+ *         the maximum period
+ */
+int adaptive_set_bounds(const adaptive_bounds_t *new_bounds)
+{
+	adaptive_period_cb_t cb = NULL;
+	bool changed = false;
+	uint32_t next = 0;
+
+	if (!bounds_valid(new_bounds)) {
+		return -EINVAL;
+	}
+
+	K_SPINLOCK(&lock) {
+		changed = memcmp(&bounds, new_bounds, sizeof(bounds)) != 0;
+		if (changed) {
+			bounds = *new_bounds;
+			period = override ? override : bounds.min_period;
+			next = period;
+			cb = period_cb;
+		}
+	}
+	if (!changed) {
+		return 0;
+	}
+	k_work_submit(&save_work);
+
+	LOG_INF("Sampling period between %u and %u s, threshold %u",
+		new_bounds->min_period, new_bounds->max_period,
+		new_bounds->threshold);
+	if (cb) {
+		cb(next);
+	}
+	return 0;
+}
+
+/**
+ * @brief Fixes the sampling period until further notice, without saving it
+ * 
+ * The period stops adapting and the persisted bounds are left untouched,
+ * so the override ends at the latest with a reboot. The same override set
+ * again is ignored, so repeating it does not postpone the next sample.
+ * Can be called from any thread.
+ * 
+ * @param seconds Sampling period in seconds, 0 to adapt again from the
+ *                minimum period
+ */
+void adaptive_set_override(uint16_t seconds)
+{
+	adaptive_period_cb_t cb = NULL;
+	uint32_t next = 0;
+
+	K_SPINLOCK(&lock) {
+		if (override != seconds) {
+			override = seconds;
+			period = seconds ? seconds : bounds.min_period;
+			next = period;
+			cb = period_cb;
+		}
+	}
+	if (!next) {
+		return;
+	}
+
+	if (seconds) {
+		LOG_INF("Sampling period fixed to %u s", seconds);
+	} else {
+		LOG_INF("Sampling period adapts again");
+	}
+	if (cb) {
+		cb(next);
+	}
+}
+
+/**
+ * @brief Returns the current bounds of the sampling period
+ * 
+ * @param current Filled with the current bounds
+ */
+void adaptive_get_bounds(adaptive_bounds_t *current)
+{
+	K_SPINLOCK(&lock) {
+		*current = bounds;
+	}
+}
+
+/**
+ * @brief Reads the bounds of the sampling period
+ * 
+ * The value holds the minimum period, the maximum period, both in seconds,
+ * and the threshold, each as a big-endian uint16.
+ * 
+ * @param conn BLE connection handle
+ * @param attr GATT attribute being read
+ * @param buf Buffer to store the read data
+ * @param len Maximum length of data to read
+ * @param offset Offset within the attribute value
+ * @return Number of bytes read, or negative error code on failure
+ */
+static ssize_t read_bounds(struct bt_conn *conn,
+			   const struct bt_gatt_attr *attr, void *buf,
+			   uint16_t len, uint16_t offset)
+{
+	adaptive_bounds_t current;
+	uint8_t value[ADAPTIVE_BOUNDS_SIZE];
+
+	adaptive_get_bounds(&current);
+	sys_put_be16(current.min_period, &value[0]);
+	sys_put_be16(current.max_period, &value[2]);
+	sys_put_be16(current.threshold, &value[4]);
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, value,
+				 sizeof(value));
+}
+
+/**
+ * @brief Writes the bounds of the sampling period
+ * 
+ * @param conn BLE connection handle
+ * @param attr GATT attribute being written
+ * @param buf Written value, laid out like the read value
+ * @param len Length of the written value
+ * @param offset Write offset
+ * @param flags Write flags
+ * @return Number of bytes written, or a negative ATT error code
+ */
+static ssize_t write_bounds(struct bt_conn *conn,
+			    const struct bt_gatt_attr *attr, const void *buf,
+			    uint16_t len, uint16_t offset, uint8_t flags)
+{
+	const uint8_t *value = buf;
+
+	if (offset) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+	if (len != ADAPTIVE_BOUNDS_SIZE) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	const adaptive_bounds_t new_bounds = {
+		.min_period = sys_get_be16(&value[0]),
+		.max_period = sys_get_be16(&value[2]),
+		.threshold = sys_get_be16(&value[4]),
+	};
+	if (adaptive_set_bounds(&new_bounds)) {
+		return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+	}
+	return len;
+}
+
+/**
+ * @brief Settings handler restoring the bounds of the sampling period
+ * 
+ * @param name Key relative to the adaptive subtree
+ * @param len Length of the stored value
+ * @param read_cb Function reading the stored value
+ * @param cb_arg Argument of read_cb
+ * @return 0 on success, negative error code otherwise
+ */
+static int adaptive_set(const char *name, size_t len, settings_read_cb read_cb,
+			void *cb_arg)
+{
+	adaptive_bounds_t stored;
+
+	if (strcmp(name, ADAPTIVE_BOUNDS_NAME) || len != sizeof(stored)) {
+		LOG_WRN("Ignoring sampling setting %s", name);
+		return 0;
+	}
+
+	ssize_t ret = read_cb(cb_arg, &stored, sizeof(stored));
+	if (ret < 0) {
+		return ret;
+	}
+	if (!bounds_valid(&stored)) {
+		LOG_WRN("Ignoring invalid sampling bounds");
+		return 0;
+	}
+
+	K_SPINLOCK(&lock) {
+		bounds = stored;
+	}
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(adaptive, ADAPTIVE_SUBTREE, NULL, adaptive_set,
+			       NULL, NULL);
@@ -0,0 +1,79 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <stdint.h>
+
+/* Bounds of the adaptive sampling period, as stored in settings */
+typedef struct {
+	uint16_t min_period; // Fast sampling period in seconds
+	uint16_t max_period; // Slowest sampling period in seconds
+	uint16_t threshold;  // Temperature change between samples seen as flat
+} adaptive_bounds_t;
+
+/**
+ * @brief Callback invoked when the sampling period changes
+ * 
+ * @param seconds New sampling period in seconds
+ */
+typedef void (*adaptive_period_cb_t)(uint32_t seconds);
+
+/**
+ * @brief Initializes the adaptive sampling period
+ * 
+ * The bounds are loaded from settings along with the Bluetooth settings,
+ * so this must be called after ble_setup(). The sampling period starts at
+ * the minimum period.
+ * 
+ * @param cb Callback invoked when the sampling period changes
+ * @return Initial sampling period in seconds
+ */
+uint32_t adaptive_init(adaptive_period_cb_t cb);
+
+/**
+ * @brief Adapts the sampling period to a new temperature sample
+ * 
+ * While the temperature changes by no more than the threshold between two
+ * samples, the period doubles up to the maximum period. As soon as it
+ * changes by more, the period snaps back to the minimum period. Since the
+ * change is measured over the period, a slow drift also brings the period
+ * back down before it grows too long. While an override is set, the period
+ * stays at the override. Called from the system work queue.
+ * 
+ * @param temperature Temperature of the sample
+ */
+void adaptive_update(int16_t temperature);
+
+/**
+ * @brief Changes and persists the bounds of the sampling period
+ * 
+ * The sampling period restarts at the new minimum period, or at the
+ * override if one is set. Bounds equal to the current ones are ignored, so
+ * writing them again neither wears the flash nor postpones the next sample.
+ * 
+ * @param new_bounds New bounds
+ * @return 0 on success, -EINVAL if the minimum period is 0 or greater than
+ *         the maximum period
+ */
+int adaptive_set_bounds(const adaptive_bounds_t *new_bounds);
+
+/**
+ * @brief Fixes the sampling period until further notice, without saving it
+ * 
+ * The period stops adapting and the persisted bounds are left untouched,
+ * so the override ends at the latest with a reboot. The same override set
+ * again is ignored, so repeating it does not postpone the next sample.
+ * Can be called from any thread.
+ * 
+ * @param seconds Sampling period in seconds, 0 to adapt again from the
+ *                minimum period
+ */
+void adaptive_set_override(uint16_t seconds);
+
+/**
+ * @brief Returns the current bounds of the sampling period
+ * 
+ * @param current Filled with the current bounds
+ */
+void adaptive_get_bounds(adaptive_bounds_t *current);
+
+#endif
@@ -1,5 +1,8 @@
 #include "ble.h"
 #include "sensor.h"
+#include "sample_buffer.h"
+#include "encoding.h"
+#include "pawr.h"
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/gap.h>
 #include <zephyr/bluetooth/hci.h>
@@ -10,6 +13,9 @@
 #include <zephyr/logging/log.h>
 #include <zephyr/drivers/hwinfo.h>
 #include <zephyr/settings/settings.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+#include <string.h>
 #include "version.h"
 
 LOG_MODULE_REGISTER(ble, LOG_LEVEL_INF);
@@ -27,40 +33,209 @@ static ssize_t read_attribute(struct bt_conn *conn,
 static void notification_ccc_changed(const struct bt_gatt_attr *attr,
 				     uint16_t value);
 
+static ssize_t read_period(struct bt_conn *conn,
+			   const struct bt_gatt_attr *attr, void *buf,
+			   uint16_t len, uint16_t offset);
+static ssize_t write_period(struct bt_conn *conn,
+			    const struct bt_gatt_attr *attr, const void *buf,
+			    uint16_t len, uint16_t offset, uint8_t flags);
+
 static char device_name[CONFIG_BT_DEVICE_NAME_MAX];
 
 static const struct bt_data ad[] = {
 	BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
 	BT_DATA(BT_DATA_NAME_COMPLETE, device_name, sizeof(device_name))
 };
-static struct bt_le_adv_param *adv_param = BT_LE_ADV_PARAM(
-	(BT_LE_ADV_OPT_CONNECTABLE | BT_LE_ADV_OPT_USE_IDENTITY), 800, 16384,
-	NULL);
-
-static struct bt_conn *current_connection = NULL;
-static struct bt_gatt_exchange_params exchange_params;
-
-BT_GATT_SERVICE_DEFINE(battery_svc,
-		       BT_GATT_PRIMARY_SERVICE(BT_UUID_BATTERY_SVC),
-		       BT_GATT_CHARACTERISTIC(BT_UUID_BATTERY,
-					      BT_GATT_CHRC_READ,
-					      BT_GATT_PERM_READ, read_attribute,
-					      NULL, &sensor_data.battery_mv));
-
-BT_GATT_SERVICE_DEFINE(temperature_svc,
-		       BT_GATT_PRIMARY_SERVICE(BT_UUID_TEMPERATURE_SVC),
-		       BT_GATT_CHARACTERISTIC(BT_UUID_TEMPERATURE,
-					      BT_GATT_CHRC_READ,
-					      BT_GATT_PERM_READ, read_attribute,
-					      NULL, &sensor_data.temperature));
+
+/* Connection parameters requested by the peripheral */
+typedef enum {
+	PARAMS_DEFAULT, // Preferred parameters of prj.conf, used at first
+	PARAMS_IDLE, // Between batches
+	PARAMS_FAST, // During a bulk download or a burst stream
+} conn_params_t;
+
+/* Interval in units of 1.25 ms */
+#define IDLE_INTERVAL  (CONFIG_LIONK_CONN_IDLE_INTERVAL * 4 / 5)
+/* Longest time between two events the peripheral listens to, in ms */
+#define IDLE_PERIOD_MS \
+	((1 + CONFIG_LIONK_CONN_IDLE_LATENCY) * CONFIG_LIONK_CONN_IDLE_INTERVAL)
+/* Supervision timeout in units of 10 ms, twice the smallest allowed */
+#define IDLE_TIMEOUT   MIN(IDLE_PERIOD_MS * 4 / 10, 3200)
+
+BUILD_ASSERT(IDLE_PERIOD_MS * 2 < 32000,
+	     "Idle latency too high for the longest supervision timeout");
+
+static const struct bt_le_conn_param conn_params[] = {
+	[PARAMS_DEFAULT] = BT_LE_CONN_PARAM_INIT(
+		CONFIG_BT_PERIPHERAL_PREF_MIN_INT,
+		CONFIG_BT_PERIPHERAL_PREF_MAX_INT,
+		CONFIG_BT_PERIPHERAL_PREF_LATENCY,
+		CONFIG_BT_PERIPHERAL_PREF_TIMEOUT),
+	[PARAMS_IDLE] = BT_LE_CONN_PARAM_INIT(IDLE_INTERVAL, IDLE_INTERVAL,
+					      CONFIG_LIONK_CONN_IDLE_LATENCY,
+					      IDLE_TIMEOUT),
+	[PARAMS_FAST] = BT_LE_CONN_PARAM_INIT(6, 12, 0, 400),
+};
+
+static const char *const conn_params_names[] = {
+	[PARAMS_DEFAULT] = "default",
+	[PARAMS_IDLE] = "idle",
+	[PARAMS_FAST] = "fast",
+};
+
+/* Shortest time between two parameter requests on a connection */
+#define PARAMS_MIN_GAP_MS 2000
+
+/* State of a connected central, indexed by bt_conn_index() */
+typedef struct {
+	struct bt_gatt_exchange_params exchange_params;
+	uint16_t payload_mtu;
+	bool subscribed;
+	uint16_t period; // Reporting period in seconds, 0 to send batches
+	uint32_t last_report; // Time of the last report in seconds
+	uint32_t next_seq; // Sequence number of the next sample to queue
+	uint32_t acked_seq; // Of the first sample not confirmed sent
+	bool flushing; // A report is being sent
+	atomic_t throughput; // Users of the fast parameters
+	bool idle_due; // A batch was sent, the link can idle
+	conn_params_t params; // Last parameters requested
+	int64_t params_time; // Uptime of the last request in ms
+} connection_ctx_t;
+
+static connection_ctx_t contexts[CONFIG_BT_MAX_CONN];
+static atomic_t connection_count;
+
+/* Delay before advertising again when the stack refused to */
+#define ADVERTISING_RETRY	 K_SECONDS(1)
+
+/* High duty cycle directed advertising is limited to 1.28 s */
+#define DIRECTED_ADV_DURATION_MS 1280
+
+typedef enum {
+	IDLE, // Not advertising while a connection is free
+	ADVERTISING,
+	CONNECTED, // Every connection is used
+} ble_state_t;
+
+/* Advertising phases, from the fastest to the most frugal */
+typedef enum {
+	PHASE_DIRECTED,
+	PHASE_FAST,
+	PHASE_MEDIUM,
+	PHASE_SLOW,
+} adv_phase_t;
+
+typedef struct {
+	uint16_t interval_min; // In units of 0.625 ms
+	uint16_t interval_max;
+	uint32_t duration_ms; // 0 until a central connects
+} adv_profile_t;
+
+static const adv_profile_t adv_profiles[] = {
+	[PHASE_DIRECTED] = { 0, 0, DIRECTED_ADV_DURATION_MS },
+	[PHASE_FAST] = { BT_GAP_ADV_FAST_INT_MIN_1, BT_GAP_ADV_FAST_INT_MAX_1,
+			 CONFIG_LIONK_ADV_FAST_DURATION * MSEC_PER_SEC },
+	[PHASE_MEDIUM] = { BT_GAP_ADV_FAST_INT_MIN_2, BT_GAP_ADV_FAST_INT_MAX_2,
+			   CONFIG_LIONK_ADV_MEDIUM_DURATION * MSEC_PER_SEC },
+	[PHASE_SLOW] = { 800, 16384, 0 },
+};
+
+static void update_state(struct k_work *work);
+
+K_WORK_DELAYABLE_DEFINE(state_work, update_state);
+
+static void update_params(struct k_work *work);
+
+K_WORK_DELAYABLE_DEFINE(params_work, update_params);
+
+static void send_frames(struct k_work *work);
+static void release_frames(struct bt_conn *conn);
+
+K_WORK_DELAYABLE_DEFINE(send_work, send_frames);
+
+/* Only accessed from the system work queue */
+static ble_state_t state = IDLE;
+static adv_phase_t phase = PHASE_DIRECTED;
+static int64_t phase_end;
+static atomic_val_t adv_connections; // Connections when advertising began
+static bool bonded; // Any central is bonded
+static bool gateway_bonded; // The gateway is among the bonded centrals
+
+#define GATEWAY_SUBTREE "gateway"
+#define GATEWAY_NAME	"addr"
+
+static void save_gateway(struct k_work *work);
+static struct bt_conn_auth_info_cb auth_info_callbacks;
+
+K_WORK_DEFINE(gateway_work, save_gateway);
+
+/* First central that bonded, target of directed advertising */
+static struct k_spinlock gateway_lock;
+static bt_addr_le_t gateway;
+static bool gateway_known;
+
+#if defined(CONFIG_LIONK_BROADCAST)
+/* Service data holds the data service UUID followed by the reading */
+#define BROADCAST_UUID_SIZE 16
+#define BROADCAST_SIZE	    (BROADCAST_UUID_SIZE + ENCODING_READING_SIZE)
+
+static struct bt_le_ext_adv *broadcast_adv;
+static uint8_t broadcast_payload[BROADCAST_SIZE] = {
+	BT_UUID_DATA_SVC_VAL
+};
+static struct bt_data broadcast_ad[] = {
+	BT_DATA(BT_DATA_SVC_DATA128, broadcast_payload,
+		sizeof(broadcast_payload)),
+	BT_DATA(BT_DATA_NAME_COMPLETE, device_name, 0),
+};
+static const struct bt_le_adv_param broadcast_param = BT_LE_ADV_PARAM_INIT(
+	(BT_LE_ADV_OPT_EXT_ADV | BT_LE_ADV_OPT_CODED |
+	 BT_LE_ADV_OPT_USE_IDENTITY),
+	CONFIG_LIONK_BROADCAST_INTERVAL * 8 / 5,
+	CONFIG_LIONK_BROADCAST_INTERVAL * 8 / 5, NULL);
+#endif
+
+BT_GATT_SERVICE_DEFINE(
+	battery_svc, BT_GATT_PRIMARY_SERVICE(BT_UUID_BATTERY_SVC),
+	BT_GATT_CHARACTERISTIC(BT_UUID_BATTERY, BT_GATT_CHRC_READ,
+			       BT_GATT_PERM_READ, read_attribute, NULL,
+			       UINT_TO_POINTER(BATTERY_CHANNEL)));
+
+BT_GATT_SERVICE_DEFINE(
+	temperature_svc, BT_GATT_PRIMARY_SERVICE(BT_UUID_TEMPERATURE_SVC),
+	BT_GATT_CHARACTERISTIC(BT_UUID_TEMPERATURE, BT_GATT_CHRC_READ,
+			       BT_GATT_PERM_READ, read_attribute, NULL,
+			       UINT_TO_POINTER(TEMPERATURE_CHANNEL)));
+
+/* One characteristic per zephyr,user io-channel, described by its name */
+#define CHANNEL_CHARACTERISTIC(node_id, prop, idx)                      \
+	BT_GATT_CHARACTERISTIC(BT_UUID_CHANNEL(idx), BT_GATT_CHRC_READ, \
+			       BT_GATT_PERM_READ, read_attribute, NULL, \
+			       UINT_TO_POINTER(idx)),                   \
+	BT_GATT_CUD(DT_PROP_BY_IDX(node_id, io_channel_names, idx),     \
+		    BT_GATT_PERM_READ),
+
+BT_GATT_SERVICE_DEFINE(channel_svc,
+		       BT_GATT_PRIMARY_SERVICE(BT_UUID_CHANNEL_SVC),
+		       DT_FOREACH_PROP_ELEM(LIONK_CHANNELS_NODE, io_channels,
+					    CHANNEL_CHARACTERISTIC));
 
 BT_GATT_SERVICE_DEFINE(data_svc, BT_GATT_PRIMARY_SERVICE(BT_UUID_DATA_SVC),
+		       BT_GATT_CHARACTERISTIC(BT_UUID_REPORT_PERIOD,
+					      BT_GATT_CHRC_READ |
+						      BT_GATT_CHRC_WRITE,
+					      BT_GATT_PERM_READ |
+						      BT_GATT_PERM_WRITE,
+					      read_period, write_period, NULL),
 		       BT_GATT_CHARACTERISTIC(BT_UUID_DATA, BT_GATT_CHRC_NOTIFY,
 					      BT_GATT_PERM_NONE, NULL, NULL,
 					      NULL),
 		       BT_GATT_CCC(notification_ccc_changed,
 				   BT_GATT_PERM_READ | BT_GATT_PERM_WRITE), );
 
+/* Value of the data characteristic, followed by its CCC */
+#define DATA_ATTR (&data_svc.attrs[data_svc.attr_count - 2])
+
 BT_GATT_SERVICE_DEFINE(
 	version_svc, BT_GATT_PRIMARY_SERVICE(BT_UUID_VERSION_SVC),
 	BT_GATT_CHARACTERISTIC(BT_UUID_VERSION, BT_GATT_CHRC_READ,
@@ -96,8 +271,8 @@ static ssize_t read_version(struct bt_conn *conn,
  * @brief Reads sensor data attributes for BLE GATT characteristics
  * 
  * This function is called when a BLE client reads temperature or battery
- * characteristics. It returns the current sensor values from the global
- * sensor_data structure.
+ * characteristics. It returns the value of the channel, whose index is the
+ * attribute user data, from a consistent copy of the latest sample set.
  * 
  * @param conn BLE connection handle
  * @param attr GATT attribute being read
@@ -110,17 +285,90 @@ static ssize_t read_attribute(struct bt_conn *conn,
 			      const struct bt_gatt_attr *attr, void *buf,
 			      uint16_t len, uint16_t offset)
 {
-	const uint16_t *value = (uint16_t *)attr->user_data;
+	sensor_snapshot_t snapshot;
+
+	sensor_read(&snapshot);
 
+	const uint16_t value =
+		snapshot.data.values[POINTER_TO_UINT(attr->user_data)];
+
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, &value,
+				 sizeof(value));
+}
+
+/**
+ * @brief Returns the state of a connected central
+ * 
+ * @param conn BLE connection handle
+ * @return Context of the connection
+ */
+static connection_ctx_t *context(const struct bt_conn *conn)
+{
+	return &contexts[bt_conn_index(conn)];
+}
+
+/**
+ * @brief Reads the reporting period of the reading central
+ * 
+ * The period is a big-endian uint16 in seconds. 0, the default on every
+ * connection, sends batches as configured by CONFIG_LIONK_BATCH_SIZE and
+ * CONFIG_LIONK_BATCH_MAX_AGE.
+ * 
+ * @param conn BLE connection handle
+ * @param attr GATT attribute being read
+ * @param buf Buffer to store the response
+ * @param len Maximum length of the response
+ * @param offset Offset for partial reads
+ * @return Number of bytes written to the buffer
+ */
+static ssize_t read_period(struct bt_conn *conn,
+			   const struct bt_gatt_attr *attr, void *buf,
+			   uint16_t len, uint16_t offset)
+{
+	uint8_t value[sizeof(uint16_t)];
+
+	sys_put_be16(context(conn)->period, value);
 	return bt_gatt_attr_read(conn, attr, buf, len, offset, value,
-				 sizeof(*value));
+				 sizeof(value));
+}
+
+/**
+ * @brief Changes the reporting period of the writing central
+ * 
+ * Each central has its own period, so a backup gateway can collect the
+ * samples less often than the primary one.
+ * 
+ * @param conn BLE connection handle
+ * @param attr GATT attribute being written
+ * @param buf Written value, laid out like the read value
+ * @param len Length of the written value
+ * @param offset Write offset
+ * @param flags Write flags
+ * @return Number of bytes written, or a negative ATT error code
+ */
+static ssize_t write_period(struct bt_conn *conn,
+			    const struct bt_gatt_attr *attr, const void *buf,
+			    uint16_t len, uint16_t offset, uint8_t flags)
+{
+	if (offset) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+	if (len != sizeof(uint16_t)) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	context(conn)->period = sys_get_be16(buf);
+	LOG_INF("Reporting period %u s", context(conn)->period);
+	return len;
 }
 
 /**
  * @brief Handles changes to the Client Characteristic Configuration (CCC)
  * 
  * This callback is triggered when a BLE client enables or disables notifications
- * for the data characteristic. It updates the global subscription state.
+ * for the data characteristic. The value is the aggregate of all connected
+ * clients, so it tells whether at least one of them subscribed; the state of
+ * each client is checked when sending.
  * 
  * @param attr GATT attribute that was modified
  * @param value New CCC value (BT_GATT_CCC_NOTIFY if notifications enabled)
@@ -137,7 +385,8 @@ static void notification_ccc_changed(const struct bt_gatt_attr *attr,
  * 
  * This function requests a change to the BLE connection's PHY to use coded PHY,
  * which provides better range at the cost of data rate. This is useful for
- * IoT applications requiring extended communication distance.
+ * IoT applications requiring extended communication distance. With
+ * CONFIG_LIONK_LINK_ADAPTATION, the PHY then follows the link margin.
  * 
  * @param conn BLE connection handle to update
  */
@@ -194,6 +443,7 @@ static void exchange_func(struct bt_conn *conn, uint8_t att_err,
 	if (!att_err) {
 		uint16_t payload_mtu = bt_gatt_get_mtu(conn) -
 				       3; // 3 bytes used for Attribute headers.
+		context(conn)->payload_mtu = payload_mtu;
 		LOG_INF("New MTU: %d bytes", payload_mtu);
 	}
 }
@@ -210,9 +460,10 @@ static void exchange_func(struct bt_conn *conn, uint8_t att_err,
 static void update_mtu(struct bt_conn *conn)
 {
 	int err;
-	exchange_params.func = exchange_func;
+	connection_ctx_t *ctx = context(conn);
 
-	err = bt_gatt_exchange_mtu(conn, &exchange_params);
+	ctx->exchange_params.func = exchange_func;
+	err = bt_gatt_exchange_mtu(conn, &ctx->exchange_params);
 	if (err) {
 		LOG_ERR("bt_gatt_exchange_mtu failed (err %d)", err);
 	}
@@ -222,8 +473,8 @@ static void update_mtu(struct bt_conn *conn)
  * @brief Callback function called when a BLE connection is established
  * 
  * This function is invoked when a BLE central device successfully connects
- * to this peripheral. It logs connection details, stores the connection
- * reference, and initiates optimization procedures (PHY update, data length
+ * to this peripheral. It logs connection details, resets the context of the
+ * connection, and initiates optimization procedures (PHY update, data length
  * extension, and MTU exchange) for better performance.
  * 
  * @param conn BLE connection handle
@@ -231,14 +482,26 @@ static void update_mtu(struct bt_conn *conn)
  */
 static void connected(struct bt_conn *conn, uint8_t err)
 {
+	if (err == BT_HCI_ERR_ADV_TIMEOUT) {
+		LOG_INF("Directed advertising timed out");
+		ble_update_state();
+		return;
+	}
 	if (err) {
 		LOG_ERR("Connection failed (err 0x%02x)", err);
+		ble_update_state();
 		return;
 	}
 	char addr[BT_ADDR_LE_STR_LEN];
 	struct bt_conn_info info;
+	connection_ctx_t *ctx = context(conn);
 	bt_conn_get_info(conn, &info);
-	current_connection = bt_conn_ref(conn);
+	*ctx = (connection_ctx_t){
+		.payload_mtu = bt_gatt_get_mtu(conn) - 3,
+		.params = PARAMS_DEFAULT,
+		.params_time = k_uptime_get(),
+	};
+	atomic_inc(&connection_count);
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 	double connection_interval = info.le.interval * 1.25;
 	uint16_t supervision_timeout = info.le.timeout * 10;
@@ -250,23 +513,154 @@ static void connected(struct bt_conn *conn, uint8_t err)
 	update_phy(conn);
 	update_data_length(conn);
 	update_mtu(conn);
+	ble_update_state();
 }
 
 /**
  * @brief Callback function called when a BLE connection is terminated
  * 
  * This function is invoked when the BLE connection is disconnected, either
- * by the central device or due to connection timeout/error. It cleans up
- * the connection reference and logs the disconnection reason.
+ * by the central device or due to connection timeout/error. It releases
+ * the connection and its notifications in flight, whose samples stay
+ * buffered, and logs the disconnection reason.
  * 
  * @param conn BLE connection handle that was disconnected
  * @param reason Disconnection reason code as defined by Bluetooth spec
  */
 static void disconnected(struct bt_conn *conn, uint8_t reason)
 {
-	bt_conn_unref(conn);
-	current_connection = NULL;
+	context(conn)->subscribed = false;
+	release_frames(conn);
+	atomic_dec(&connection_count);
 	LOG_INF("Disconnected (reason 0x%02x)", reason);
+	ble_update_state();
+}
+
+/**
+ * @brief Callback function called when a connection object is released
+ * 
+ * Advertising again needs a free connection object, so the device only
+ * advertises once the terminated connection is recycled.
+ */
+static void recycled(void)
+{
+	ble_update_state();
+}
+
+/**
+ * @brief Selects the parameters a connection should use
+ * 
+ * The fast parameters are kept while a bulk download or a burst stream
+ * runs. Afterwards, or once a batch was sent, the link idles.
+ * 
+ * @param ctx Context of the connection
+ * @return Parameters to request
+ */
+static conn_params_t wanted_params(const connection_ctx_t *ctx)
+{
+	if (atomic_get(&ctx->throughput) > 0) {
+		return PARAMS_FAST;
+	}
+	if (ctx->idle_due || ctx->params == PARAMS_FAST) {
+		return PARAMS_IDLE;
+	}
+	return ctx->params;
+}
+
+/**
+ * @brief Requests the parameters a connection should use
+ * 
+ * Requests on a connection are at least PARAMS_MIN_GAP_MS apart; a change
+ * coming sooner is postponed.
+ * 
+ * @param conn BLE connection handle
+ * @param data Uptime in ms of the earliest postponed request, updated
+ */
+static void update_conn_params(struct bt_conn *conn, void *data)
+{
+	int64_t *retry = data;
+	connection_ctx_t *ctx = context(conn);
+	struct bt_conn_info info;
+
+	if (bt_conn_get_info(conn, &info) ||
+	    info.state != BT_CONN_STATE_CONNECTED) {
+		return;
+	}
+
+	conn_params_t wanted = wanted_params(ctx);
+	if (wanted == ctx->params) {
+		return;
+	}
+
+	int64_t now = k_uptime_get();
+	int64_t allowed = ctx->params_time + PARAMS_MIN_GAP_MS;
+	if (now < allowed) {
+		*retry = MIN(*retry, allowed);
+		return;
+	}
+
+	int err = bt_conn_le_param_update(conn, &conn_params[wanted]);
+	ctx->params_time = now;
+	if (err && err != -EALREADY) {
+		LOG_ERR("Couldn't request %s connection parameters (%d)",
+			conn_params_names[wanted], err);
+		*retry = MIN(*retry, now + PARAMS_MIN_GAP_MS);
+		return;
+	}
+	ctx->params = wanted;
+	LOG_INF("Requesting %s connection parameters",
+		conn_params_names[wanted]);
+}
+
+/**
+ * @brief Brings the parameters of every connection up to date
+ * 
+ * Runs on the system work queue whenever the activity of a connection
+ * changes, and again when a postponed request is allowed.
+ * 
+ * @param work Pointer to the work structure (unused)
+ */
+static void update_params(struct k_work *work)
+{
+	int64_t retry = INT64_MAX;
+
+	(void)work;
+	bt_conn_foreach(BT_CONN_TYPE_LE, update_conn_params, &retry);
+	if (retry != INT64_MAX) {
+		k_work_reschedule(&params_work, K_TIMEOUT_ABS_MS(retry));
+	}
+}
+
+/**
+ * @brief Asks for a short connection interval on a connection
+ * 
+ * Called before a bulk download or a burst stream. Every call must be
+ * balanced by ble_release_throughput(). Can be called from any thread.
+ * 
+ * @param conn BLE connection handle
+ */
+void ble_request_throughput(struct bt_conn *conn)
+{
+	atomic_inc(&context(conn)->throughput);
+	k_work_reschedule(&params_work, K_NO_WAIT);
+}
+
+/**
+ * @brief Lets a connection idle again after a transfer
+ * 
+ * Once the last user released it, the connection falls back to the idle
+ * parameters. Can be called from any thread.
+ * 
+ * @param conn BLE connection handle
+ */
+void ble_release_throughput(struct bt_conn *conn)
+{
+	atomic_t *throughput = &context(conn)->throughput;
+
+	if (atomic_get(throughput) > 0) {
+		atomic_dec(throughput);
+	}
+	k_work_reschedule(&params_work, K_NO_WAIT);
 }
 
 /**
@@ -274,7 +668,8 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
  * 
  * This function is invoked when the connection interval, latency, or supervision
  * timeout parameters are changed during an active BLE connection. It logs the
- * new parameter values for debugging and monitoring purposes.
+ * new parameter values for debugging and monitoring purposes, and whether the
+ * central applied the parameters last requested.
  * 
  * @param conn BLE connection handle
  * @param interval Connection interval in 1.25ms units
@@ -284,8 +679,17 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
 static void le_param_updated(struct bt_conn *conn, uint16_t interval,
 			     uint16_t latency, uint16_t timeout)
 {
+	conn_params_t params = context(conn)->params;
+	const struct bt_le_conn_param *requested = &conn_params[params];
+
 	LOG_INF("Connection parameters updated: interval %.2f ms, latency %d, timeout %d ms",
 		interval * 1.25, latency, timeout * 10);
+	if (interval < requested->interval_min ||
+	    interval > requested->interval_max ||
+	    latency != requested->latency) {
+		LOG_WRN("Central did not apply the %s connection parameters",
+			conn_params_names[params]);
+	}
 }
 
 /**
@@ -332,6 +736,39 @@ static void le_data_len_updated(struct bt_conn *conn,
 		tx_len, rx_len, tx_time, rx_time);
 }
 
+#if defined(CONFIG_LIONK_BROADCAST)
+/**
+ * @brief Creates and starts the broadcast advertising set
+ * 
+ * The set is non-connectable extended advertising on LE Coded PHY, running
+ * next to the connectable advertising. Its service data holds the latest
+ * reading and is refreshed by ble_broadcast_update().
+ */
+static void broadcast_start(void)
+{
+	broadcast_ad[1].data_len = strlen(device_name);
+
+	int err = bt_le_ext_adv_create(&broadcast_param, NULL, &broadcast_adv);
+	if (err) {
+		LOG_ERR("Couldn't create broadcast advertising set (err %d)",
+			err);
+		return;
+	}
+
+	err = bt_le_ext_adv_set_data(broadcast_adv, broadcast_ad,
+				     ARRAY_SIZE(broadcast_ad), NULL, 0);
+	if (!err) {
+		err = bt_le_ext_adv_start(broadcast_adv,
+					  BT_LE_EXT_ADV_START_DEFAULT);
+	}
+	if (err) {
+		LOG_ERR("Couldn't start broadcast advertising (err %d)", err);
+		return;
+	}
+	LOG_INF("Broadcasting on Coded PHY");
+}
+#endif
+
 /**
  * @brief Initializes the BLE subsystem and configures device settings
  * 
@@ -341,6 +778,7 @@ static void le_data_len_updated(struct bt_conn *conn,
  * - Enabling Bluetooth with default configuration
  * - Loading stored settings from flash
  * - Setting the device name for advertising
+ * - Starting the connection state machine, which advertises right away
  * 
  * This must be called before any other BLE operations.
  */
@@ -355,28 +793,281 @@ void ble_setup(void)
 
 	sprintf(device_name, CONFIG_BT_DEVICE_NAME, device_id.id);
 	int err = bt_enable(NULL);
-	settings_load();
 	__ASSERT(err == 0, "Couldn't enable bluetooth");
+	err = bt_conn_auth_info_cb_register(&auth_info_callbacks);
+	__ASSERT(err == 0, "Couldn't register pairing callbacks");
+	settings_load();
 
 	bt_set_name(device_name);
 
 	LOG_INF("Device ID: %llx", device_id.id);
 	LOG_INF("Device Name: %s", device_name);
 	LOG_INF("Bluetooth initialized");
+
+#if defined(CONFIG_LIONK_BROADCAST)
+	broadcast_start();
+#endif
+	ble_update_state();
+}
+
+/**
+ * @brief Records a bond found in the settings
+ * 
+ * Notes whether the recorded gateway is still bonded. With
+ * CONFIG_LIONK_ADV_ACCEPT_LIST, every bonded central is added to the
+ * filter accept list.
+ * 
+ * @param info Bond information
+ * @param user_data Recorded gateway, or NULL without one
+ */
+static void add_bond(const struct bt_bond_info *info, void *user_data)
+{
+	const bt_addr_le_t *recorded = user_data;
+
+	bonded = true;
+	if (recorded && bt_addr_le_eq(recorded, &info->addr)) {
+		gateway_bonded = true;
+	}
+#if defined(CONFIG_LIONK_ADV_ACCEPT_LIST)
+	int err = bt_le_filter_accept_list_add(&info->addr);
+	if (err) {
+		LOG_ERR("Couldn't add bond to the accept list (%d)", err);
+	}
+#endif
 }
 
+/**
+ * @brief Reloads the bonded gateways before advertising
+ * 
+ * Bonds may be created or removed while connected, so they are read again
+ * every time advertising starts, while the accept list is not in use.
+ */
+static void load_bonds(void)
+{
+	bt_addr_le_t recorded;
+	bool known;
+
+	K_SPINLOCK(&gateway_lock) {
+		bt_addr_le_copy(&recorded, &gateway);
+		known = gateway_known;
+	}
+	bonded = false;
+	gateway_bonded = false;
+#if defined(CONFIG_LIONK_ADV_ACCEPT_LIST)
+	bt_le_filter_accept_list_clear();
+#endif
+	bt_foreach_bond(BT_ID_DEFAULT, add_bond, known ? &recorded : NULL);
+}
+
+/**
+ * @brief Writes the gateway address to settings, or deletes it
+ * 
+ * Runs on the system work queue, so the Bluetooth callbacks do not wait
+ * for flash.
+ * 
+ * @param work Pointer to the work structure (unused)
+ */
+static void save_gateway(struct k_work *work)
+{
+	bt_addr_le_t addr;
+	bool known;
+	int err;
+
+	(void)work;
+	K_SPINLOCK(&gateway_lock) {
+		bt_addr_le_copy(&addr, &gateway);
+		known = gateway_known;
+	}
+	if (known) {
+		err = settings_save_one(GATEWAY_SUBTREE "/" GATEWAY_NAME,
+					&addr, sizeof(addr));
+	} else {
+		err = settings_delete(GATEWAY_SUBTREE "/" GATEWAY_NAME);
+	}
+	if (err) {
+		LOG_ERR("Couldn't save the gateway (%d)", err);
+	}
+}
+
+/**
+ * @brief Records the first central to bond as the gateway
+ * 
+ * A central bonding later, such as a technician's phone, does not take
+ * over directed advertising. The gateway is only replaced once its bond
+ * is deleted.
+ * 
+ * @param conn BLE connection handle
+ * @param bonded_now true if the pairing created a bond
+ */
+static void pairing_complete(struct bt_conn *conn, bool bonded_now)
+{
+	bool recorded = false;
+
+	if (!bonded_now) {
+		return;
+	}
+	K_SPINLOCK(&gateway_lock) {
+		if (!gateway_known) {
+			bt_addr_le_copy(&gateway, bt_conn_get_dst(conn));
+			gateway_known = true;
+			recorded = true;
+		}
+	}
+	if (recorded) {
+		LOG_INF("Gateway recorded");
+		k_work_submit(&gateway_work);
+	}
+}
+
+/**
+ * @brief Forgets the gateway when its bond is deleted
+ * 
+ * @param id Local identity of the bond
+ * @param peer Address of the central whose bond was deleted
+ */
+static void bond_deleted(uint8_t id, const bt_addr_le_t *peer)
+{
+	bool forgotten = false;
+
+	(void)id;
+	K_SPINLOCK(&gateway_lock) {
+		if (gateway_known && bt_addr_le_eq(&gateway, peer)) {
+			gateway_known = false;
+			forgotten = true;
+		}
+	}
+	if (forgotten) {
+		LOG_INF("Gateway bond deleted");
+		k_work_submit(&gateway_work);
+	}
+}
+
+static struct bt_conn_auth_info_cb auth_info_callbacks = {
+	.pairing_complete = pairing_complete,
+	.bond_deleted = bond_deleted,
+};
+
+/**
+ * @brief Settings handler restoring the gateway address
+ * 
+ * @param name Key relative to the gateway subtree
+ * @param len Length of the stored value
+ * @param read_cb Function reading the stored value
+ * @param cb_arg Argument of read_cb
+ * @return 0 on success, negative error code otherwise
+ */
+static int gateway_set(const char *name, size_t len, settings_read_cb read_cb,
+		       void *cb_arg)
+{
+	bt_addr_le_t stored;
+
+	if (strcmp(name, GATEWAY_NAME) || len != sizeof(stored)) {
+		LOG_WRN("Ignoring gateway setting %s", name);
+		return 0;
+	}
+
+	ssize_t ret = read_cb(cb_arg, &stored, sizeof(stored));
+	if (ret < 0) {
+		return ret;
+	}
+
+	K_SPINLOCK(&gateway_lock) {
+		bt_addr_le_copy(&gateway, &stored);
+		gateway_known = true;
+	}
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(ble_gateway, GATEWAY_SUBTREE, NULL,
+			       gateway_set, NULL, NULL);
+
 /**
  * @brief Starts BLE advertising to make device discoverable
  * 
  * This function begins broadcasting advertising packets containing the device
- * name and service flags. Central devices can discover and connect to this
- * peripheral while advertising is active.
+ * name and service flags, at the interval of the current advertising phase.
+ * In the directed phase, only the recorded gateway is addressed. Once bonded,
+ * connections from unknown centrals are filtered out when
+ * CONFIG_LIONK_ADV_ACCEPT_LIST is enabled.
  * 
  * @return 0 on success, negative error code on failure
  */
-int ble_start_advertising(void)
+static int start_advertising(void)
 {
-	return bt_le_adv_start(adv_param, ad, ARRAY_SIZE(ad), NULL, 0);
+	const adv_profile_t *profile = &adv_profiles[phase];
+	struct bt_le_adv_param param = BT_LE_ADV_PARAM_INIT(
+		BT_LE_ADV_OPT_CONNECTABLE | BT_LE_ADV_OPT_ONE_TIME |
+			BT_LE_ADV_OPT_USE_IDENTITY,
+		profile->interval_min, profile->interval_max, NULL);
+	bt_addr_le_t peer;
+
+	if (phase == PHASE_DIRECTED) {
+		K_SPINLOCK(&gateway_lock) {
+			bt_addr_le_copy(&peer, &gateway);
+		}
+		param.peer = &peer;
+		return bt_le_adv_start(&param, NULL, 0, NULL, 0);
+	}
+	if (IS_ENABLED(CONFIG_LIONK_ADV_ACCEPT_LIST) && bonded) {
+		param.options |= BT_LE_ADV_OPT_FILTER_CONN;
+	}
+	return bt_le_adv_start(&param, ad, ARRAY_SIZE(ad), NULL, 0);
+}
+
+/**
+ * @brief Selects the first advertising phase worth running
+ * 
+ * Skips the directed phase unless the gateway is bonded, and the phases
+ * configured with a zero duration. While a central is connected, only the
+ * slow phase runs, so waiting for another central takes little radio time
+ * from the connected one.
+ * 
+ * @param connections Number of connected centrals
+ */
+static void skip_phases(atomic_val_t connections)
+{
+	if (connections > 0) {
+		phase = PHASE_SLOW;
+	}
+	if (phase == PHASE_DIRECTED &&
+	    (!IS_ENABLED(CONFIG_LIONK_ADV_DIRECTED) || !gateway_bonded)) {
+		phase = PHASE_FAST;
+	}
+	while (phase != PHASE_SLOW && adv_profiles[phase].duration_ms == 0) {
+		phase++;
+	}
+}
+
+/**
+ * @brief Publishes the latest reading in the broadcast advertising set
+ * 
+ * When CONFIG_LIONK_BROADCAST is enabled, this function updates in place the
+ * service data of the extended advertising set broadcast on LE Coded PHY,
+ * so passive scanners collect readings without connecting. The service data
+ * holds the data service UUID followed by the reading packed by
+ * encoding_put_reading(), from a consistent copy of the latest sample set
+ * whose sequence number numbers the reading.
+ * 
+ * @return 0 on success or if broadcasting is disabled, negative error code
+ *         on failure
+ */
+int ble_broadcast_update(void)
+{
+#if defined(CONFIG_LIONK_BROADCAST)
+	if (!broadcast_adv) {
+		return -ENODEV;
+	}
+
+	sensor_snapshot_t snapshot;
+	uint8_t *payload = &broadcast_payload[BROADCAST_UUID_SIZE];
+
+	sensor_read(&snapshot);
+	encoding_put_reading(snapshot.seq, &snapshot.data, payload);
+	return bt_le_ext_adv_set_data(broadcast_adv, broadcast_ad,
+				      ARRAY_SIZE(broadcast_ad), NULL, 0);
+#else
+	return 0;
+#endif
 }
 
 /**
@@ -388,40 +1079,140 @@ int ble_start_advertising(void)
  * 
  * @return 0 on success, negative error code on failure
  */
-int ble_stop_advertising(void)
+static int stop_advertising(void)
 {
 	return bt_le_adv_stop();
 }
 
 /**
- * @brief Serializes sensor data into a byte buffer for BLE transmission
+ * @brief Advances the connection state machine
  * 
- * This function packages the temperature and battery voltage readings into
- * a compact 5-byte buffer format:
- * - Byte 0: Reserved (always 0)
- * - Bytes 1-2: Temperature value (big-endian uint16)
- * - Bytes 3-4: Battery voltage in mV (big-endian uint16)
+ * Runs on the system work queue whenever a Bluetooth event may change the
+ * state. While a connection is free, the device advertises unless a
+ * gateway collects it over PAwR; a refused advertising start is retried
+ * after ADVERTISING_RETRY, or as soon as a connection object is recycled.
  * 
- * @param data Pointer to sensor data structure
- * @param buf Output buffer to store serialized data
- * @param len Length of output buffer (must be >= 5 bytes)
- * @return true if serialization successful, false if buffer too small
+ * Advertising runs in phases of decreasing duty cycle: directed
+ * advertising to the bonded gateway, then fast, medium and slow
+ * undirected advertising. Once the last central disconnects, advertising
+ * starts over from the first phase, so a gateway that rebooted reconnects
+ * quickly while a device left alone settles on the slow interval.
+ * 
+ * @param work Pointer to the work structure (unused)
  */
-static bool build_sensor_data_buffer(const sensor_data_t *data, uint8_t *buf,
-				     uint16_t len)
+static void update_state(struct k_work *work)
 {
-	if (len < 5) {
-		return false;
+	(void)work;
+	atomic_val_t connections = atomic_get(&connection_count);
+	int err;
+
+	switch (state) {
+	case IDLE:
+		if (connections >= CONFIG_BT_MAX_CONN) {
+			state = CONNECTED;
+			break;
+		}
+		if (pawr_is_synced()) {
+			/* The gateway collects the readings over PAwR */
+			phase = PHASE_DIRECTED;
+			break;
+		}
+		load_bonds();
+		skip_phases(connections);
+		err = start_advertising();
+		if (err == -ENOMEM) {
+			/* Retried once the last connection is recycled */
+			break;
+		}
+		if (err) {
+			LOG_ERR("Couldn't start advertising (%d)", err);
+			k_work_reschedule(&state_work, ADVERTISING_RETRY);
+			break;
+		}
+		state = ADVERTISING;
+		adv_connections = connections;
+		phase_end = k_uptime_get() + adv_profiles[phase].duration_ms;
+		if (adv_profiles[phase].duration_ms) {
+			k_work_reschedule(&state_work,
+					  K_TIMEOUT_ABS_MS(phase_end));
+		}
+		LOG_INF("Advertising, phase %d", phase);
+		break;
+
+	case ADVERTISING:
+		if (connections != adv_connections) {
+			/* A connection took the advertising, or one ended */
+			if (connections > adv_connections) {
+				LOG_INF("Connected!");
+			}
+			stop_advertising();
+			state = IDLE;
+			if (connections == 0) {
+				phase = PHASE_DIRECTED;
+			}
+			k_work_reschedule(&state_work, K_NO_WAIT);
+		} else if (pawr_is_synced()) {
+			stop_advertising();
+			state = IDLE;
+			phase = PHASE_DIRECTED;
+			LOG_INF("Advertising stopped, collected over PAwR");
+		} else if (adv_profiles[phase].duration_ms == 0) {
+			/* The slow phase lasts until a central connects */
+			break;
+		} else if (k_uptime_get() < phase_end) {
+			/* Woken up early, wait for the end of the phase */
+			k_work_reschedule(&state_work,
+					  K_TIMEOUT_ABS_MS(phase_end));
+		} else {
+			stop_advertising();
+			state = IDLE;
+			phase++;
+			k_work_reschedule(&state_work, K_NO_WAIT);
+		}
+		break;
+
+	case CONNECTED:
+		if (connections < CONFIG_BT_MAX_CONN) {
+			state = IDLE;
+			if (connections == 0) {
+				phase = PHASE_DIRECTED;
+			}
+			LOG_INF("Disconnected");
+			/* Advertise again, or wait for the recycled event */
+			k_work_reschedule(&state_work, K_NO_WAIT);
+		}
+		break;
 	}
+}
 
-	buf[0] = 0;
-	buf[1] = (data->temperature & 0xFF00) >> 8;
-	buf[2] = (data->temperature & 0xFF);
-	buf[3] = (data->battery_mv & 0xFF00) >> 8;
-	buf[4] = (data->battery_mv & 0xFF);
-	return true;
+/**
+ * @brief Re-evaluates the connection state machine
+ * 
+ * The state machine (idle, advertising, connected) runs on the system
+ * work queue and advances on the Bluetooth events themselves, so the
+ * device advertises again as soon as a connection is released, with no
+ * relation to the sampling period. This function queues an update for
+ * events the state machine cannot observe, such as a PAwR synchronization
+ * gained or lost. Can be called from any thread.
+ */
+void ble_update_state(void)
+{
+	k_work_reschedule(&state_work, K_NO_WAIT);
 }
 
+/* ATT header of a notification (opcode and attribute handle) */
+#define ATT_NOTIFY_HEADER_SIZE 3
+
+#define DATA_PAYLOAD_MAX       (CONFIG_BT_L2CAP_TX_MTU - ATT_NOTIFY_HEADER_SIZE)
+
+#if defined(CONFIG_LIONK_DATA_FORMAT_DELTA)
+#define DATA_FORMAT ENCODING_FORMAT_DELTA
+#elif defined(CONFIG_LIONK_DATA_FORMAT_LEGACY)
+#define DATA_FORMAT ENCODING_FORMAT_LEGACY
+#else
+#define DATA_FORMAT ENCODING_FORMAT_FIXED
+#endif
+
 /**
  * @brief Callback function called when BLE security level changes
  * 
@@ -451,6 +1242,7 @@ static void security_changed(struct bt_conn *conn, bt_security_t level,
 BT_CONN_CB_DEFINE(conn_callbacks) = {
 	.connected = connected,
 	.disconnected = disconnected,
+	.recycled = recycled,
 	.le_param_updated = le_param_updated,
 	.le_phy_updated = le_phy_updated,
 	.le_data_len_updated = le_data_len_updated,
@@ -471,38 +1263,460 @@ bool ble_is_subscribed(void)
 	return subscribed;
 }
 
+/* Delay before sending again when the stack is out of buffers */
+#define SEND_RETRY K_MSEC(10)
+
+/*
+ * Data notification handed to the stack, waiting for its completion. The
+ * stack copies the payload into its own buffer, so a frame only tracks the
+ * samples it holds, as the sequence number following the last one. A frame
+ * stays taken until the stack confirmed it was sent to every connection it
+ * was notified to, or the connection dropped.
+ */
+typedef struct {
+	struct bt_conn *conns[CONFIG_BT_MAX_CONN]; // By bt_conn_index()
+	size_t refs; // Unconfirmed connections, plus one while being filled
+	uint32_t end_seq; // Sequence number following the last sample
+} notify_frame_t;
+
+/* Shared with the completion callbacks, under frames_lock */
+static notify_frame_t frames[CONFIG_LIONK_NOTIFY_FRAMES];
+static struct k_spinlock frames_lock;
+
+/* Subscribers gathered by ble_send_data() and send_frames() */
+typedef struct {
+	uint32_t now;
+	size_t count;
+	struct bt_conn *conns[CONFIG_BT_MAX_CONN];
+	bool skipped[CONFIG_BT_MAX_CONN]; // Left out until the next run
+} subscribers_t;
+
+/**
+ * @brief Checks whether a subscriber should receive its pending samples
+ * 
+ * @param ctx Context of the subscriber
+ * @param now Current time in seconds since boot
+ * @return true if a report is due, false otherwise
+ */
+static bool report_due(const connection_ctx_t *ctx, uint32_t now)
+{
+	if (ctx->period == 0) {
+		return sample_buffer_flush_due(ctx->next_seq, now);
+	}
+	/* Once the period elapsed, any pending sample is reported */
+	return now - ctx->last_report >= ctx->period &&
+	       sample_buffer_flush_due(ctx->next_seq, UINT32_MAX);
+}
+
+/**
+ * @brief Gathers a connection subscribed to data notifications
+ * 
+ * A new subscriber starts with the samples still buffered. The position of
+ * a subscriber so slow that the samples it had not received were
+ * overwritten moves to the oldest buffered sample.
+ * 
+ * @param conn BLE connection handle
+ * @param data Subscribers being gathered
+ */
+static void gather_subscriber(struct bt_conn *conn, void *data)
+{
+	subscribers_t *subs = data;
+	connection_ctx_t *ctx = context(conn);
+	struct bt_conn_info info;
+	uint32_t first_seq = sample_buffer_first_seq();
+	uint32_t missed = 0;
+
+	if (bt_conn_get_info(conn, &info) ||
+	    info.state != BT_CONN_STATE_CONNECTED) {
+		return;
+	}
+	ctx->subscribed =
+		bt_gatt_is_subscribed(conn, DATA_ATTR, BT_GATT_CCC_NOTIFY);
+
+	K_SPINLOCK(&frames_lock) {
+		/* Restarts from the buffered samples when subscribing */
+		if (!ctx->subscribed) {
+			ctx->next_seq = first_seq;
+			ctx->acked_seq = first_seq;
+		} else if ((int32_t)(ctx->acked_seq - first_seq) < 0) {
+			missed = first_seq - ctx->acked_seq;
+			ctx->acked_seq = first_seq;
+		}
+	}
+	if (missed) {
+		LOG_WRN("Subscriber missed %u samples", missed);
+	}
+	if (!ctx->subscribed) {
+		ctx->flushing = false;
+		ctx->last_report = subs->now;
+		return;
+	}
+	if ((int32_t)(ctx->next_seq - first_seq) < 0) {
+		ctx->next_seq = first_seq;
+	}
+	subs->conns[subs->count++] = bt_conn_ref(conn);
+}
+
+/**
+ * @brief Gathers the connections subscribed to data notifications
+ * 
+ * @param subs Subscribers, each holding a connection reference
+ * @param now Current time in seconds since boot
+ */
+static void gather_subscribers(subscribers_t *subs, uint32_t now)
+{
+	*subs = (subscribers_t){
+		.now = now,
+	};
+	bt_conn_foreach(BT_CONN_TYPE_LE, gather_subscriber, subs);
+}
+
+/**
+ * @brief Releases the connections of gathered subscribers
+ * 
+ * @param subs Subscribers returned by gather_subscribers()
+ */
+static void release_subscribers(subscribers_t *subs)
+{
+	for (size_t i = 0; i < subs->count; i++) {
+		bt_conn_unref(subs->conns[i]);
+	}
+	subs->count = 0;
+}
+
+/**
+ * @brief Takes a free notification frame
+ * 
+ * @return Frame holding one reference for the caller, or NULL if every
+ *         frame is in flight
+ */
+static notify_frame_t *take_frame(void)
+{
+	notify_frame_t *frame = NULL;
+
+	K_SPINLOCK(&frames_lock) {
+		for (size_t i = 0; i < ARRAY_SIZE(frames); i++) {
+			if (frames[i].refs == 0) {
+				frame = &frames[i];
+				frame->refs = 1;
+				break;
+			}
+		}
+	}
+	return frame;
+}
+
+/**
+ * @brief Drops the reference of the caller to a notification frame
+ * 
+ * @param frame Frame returned by take_frame()
+ */
+static void put_frame(notify_frame_t *frame)
+{
+	K_SPINLOCK(&frames_lock) {
+		frame->refs--;
+	}
+}
+
+/**
+ * @brief Records that a frame waits for its completion on a connection
+ * 
+ * Done before notifying, as the completion may run on another thread
+ * before the notification call returns.
+ * 
+ * @param frame Notification frame
+ * @param conn BLE connection handle
+ */
+static void link_frame(notify_frame_t *frame, struct bt_conn *conn)
+{
+	K_SPINLOCK(&frames_lock) {
+		frame->conns[bt_conn_index(conn)] = conn;
+		frame->refs++;
+	}
+}
+
+/**
+ * @brief Stops a frame from waiting for its completion on a connection
+ * 
+ * Must be called with frames_lock held.
+ * 
+ * @param frame Notification frame
+ * @param conn BLE connection handle
+ * @return true if the frame was waiting, false otherwise
+ */
+static bool unlink_frame(notify_frame_t *frame, struct bt_conn *conn)
+{
+	size_t index = bt_conn_index(conn);
+
+	if (frame->conns[index] != conn) {
+		return false;
+	}
+	frame->conns[index] = NULL;
+	frame->refs--;
+	return true;
+}
+
+/**
+ * @brief Called by the stack once a data notification was sent
+ * 
+ * The samples of the frame are confirmed for the connection, so they can
+ * leave the buffer, and the sending resumes in case it waited for a frame
+ * or a buffer. Can run on any thread.
+ * 
+ * @param conn BLE connection handle
+ * @param user_data Notification frame
+ */
+static void frame_sent(struct bt_conn *conn, void *user_data)
+{
+	notify_frame_t *frame = user_data;
+	connection_ctx_t *ctx = context(conn);
+
+	K_SPINLOCK(&frames_lock) {
+		/* Ignored if the frame was released on a disconnection */
+		if (unlink_frame(frame, conn) &&
+		    (int32_t)(frame->end_seq - ctx->acked_seq) > 0) {
+			ctx->acked_seq = frame->end_seq;
+		}
+	}
+	k_work_reschedule(&send_work, K_NO_WAIT);
+}
+
+/**
+ * @brief Releases the frames in flight on a connection
+ * 
+ * Called on a disconnection, as the stack may drop the notifications it had
+ * not sent without completing them. Their samples are not confirmed, so they
+ * stay buffered.
+ * 
+ * @param conn BLE connection handle
+ */
+static void release_frames(struct bt_conn *conn)
+{
+	K_SPINLOCK(&frames_lock) {
+		for (size_t i = 0; i < ARRAY_SIZE(frames); i++) {
+			unlink_frame(&frames[i], conn);
+		}
+	}
+	k_work_reschedule(&send_work, K_NO_WAIT);
+}
+
+/**
+ * @brief Ends the report of a subscriber once all its samples are queued
+ * 
+ * @param ctx Context of the subscriber
+ * @param now Current time in seconds since boot
+ */
+static void end_report(connection_ctx_t *ctx, uint32_t now)
+{
+	ctx->flushing = false;
+	ctx->last_report = now;
+	ctx->idle_due = true;
+	/* The link idles until the next report */
+	k_work_reschedule(&params_work, K_NO_WAIT);
+}
+
+/**
+ * @brief Checks whether a subscriber is reporting from a position
+ * 
+ * @param subs Gathered subscribers
+ * @param i Index of the subscriber
+ * @param seq Sequence number of the position
+ * @return true if the subscriber takes the frame starting at seq
+ */
+static bool in_group(const subscribers_t *subs, size_t i, uint32_t seq)
+{
+	const connection_ctx_t *ctx = context(subs->conns[i]);
+
+	return !subs->skipped[i] && ctx->flushing && ctx->next_seq == seq;
+}
+
 /**
- * @brief Sends current sensor data via BLE notification
+ * @brief Queues the next frame of the reporting subscribers at a position
  * 
- * This function transmits the current temperature and battery readings
- * to a connected BLE client using GATT notifications. The data is only
- * sent if a client is connected and has subscribed to notifications.
+ * The samples are encoded once in a frame fitting the smallest MTU of the
+ * group, and the frame is notified to each member. A member whose
+ * notification fails keeps its position and is skipped until the next run;
+ * when the stack is out of buffers, the run is retried shortly.
  * 
- * @return 0 on success, -EACCES if not subscribed, or other negative error code
+ * @param subs Gathered subscribers
+ * @return true if a frame may be queued for the others, false once every
+ *         subscriber was served or every frame is in flight
  */
-int ble_send_data(void)
+static bool notify_group(subscribers_t *subs)
 {
+	static sensor_sample_t samples[CONFIG_LIONK_SAMPLE_BUFFER_SIZE];
+	static uint8_t payload[DATA_PAYLOAD_MAX];
+	size_t lead = 0;
+
+	while (lead < subs->count &&
+	       (subs->skipped[lead] || !context(subs->conns[lead])->flushing)) {
+		lead++;
+	}
+	if (lead == subs->count) {
+		return false;
+	}
+
+	uint32_t seq = context(subs->conns[lead])->next_seq;
+	size_t count =
+		sample_buffer_peek_from(seq, samples, ARRAY_SIZE(samples));
+	if (count == 0) {
+		end_report(context(subs->conns[lead]), subs->now);
+		return true;
+	}
+
+	notify_frame_t *frame = take_frame();
+	if (!frame) {
+		/* A completion resumes the sending */
+		return false;
+	}
+
+	uint16_t payload_mtu = sizeof(payload);
+	for (size_t i = lead; i < subs->count; i++) {
+		connection_ctx_t *ctx = context(subs->conns[i]);
+		if (in_group(subs, i, seq)) {
+			payload_mtu = MIN(payload_mtu, ctx->payload_mtu);
+		}
+	}
+
+	size_t len;
+	size_t n = encoding_encode(DATA_FORMAT, samples, count, payload,
+				   payload_mtu, &len);
+	/* Only read during the calls, which copy the payload */
+	struct bt_gatt_notify_params params = {
+		.attr = DATA_ATTR,
+		.data = payload,
+		.len = len,
+		.func = frame_sent,
+		.user_data = frame,
+	};
+
+	frame->end_seq = seq + n;
+
+	for (size_t i = lead; i < subs->count; i++) {
+		struct bt_conn *conn = subs->conns[i];
+		connection_ctx_t *ctx = context(conn);
+		if (!in_group(subs, i, seq)) {
+			continue;
+		}
+		if (n == 0) {
+			LOG_ERR("Couldn't encode samples");
+			subs->skipped[i] = true;
+			continue;
+		}
+
+		link_frame(frame, conn);
+		int err = bt_gatt_notify_cb(conn, &params);
+		if (err) {
+			K_SPINLOCK(&frames_lock) {
+				unlink_frame(frame, conn);
+			}
+			subs->skipped[i] = true;
+			if (err == -ENOMEM) {
+				k_work_schedule(&send_work, SEND_RETRY);
+			} else {
+				LOG_ERR("Couldn't send data (%d)", err);
+			}
+			continue;
+		}
+		ctx->next_seq = frame->end_seq;
+	}
+	put_frame(frame);
+	return true;
+}
+
+/**
+ * @brief Sends the reports in progress and drops the confirmed samples
+ * 
+ * Runs on the system work queue, like the rest of the sample buffer users.
+ * Frames are queued until the stack holds CONFIG_LIONK_NOTIFY_FRAMES of
+ * them or runs out of buffers; each completion runs it again.
+ * 
+ * @param work Pointer to the work structure (unused)
+ */
+static void send_frames(struct k_work *work)
+{
+	subscribers_t subs;
+
+	(void)work;
+	gather_subscribers(&subs, k_uptime_get() / MSEC_PER_SEC);
+	while (notify_group(&subs)) {
+	}
+
+	uint32_t first_seq = sample_buffer_first_seq();
+	uint32_t delivered = UINT32_MAX;
+
+	K_SPINLOCK(&frames_lock) {
+		for (size_t i = 0; i < subs.count; i++) {
+			int32_t acked = context(subs.conns[i])->acked_seq -
+					first_seq;
+			delivered = MIN(delivered, (uint32_t)MAX(acked, 0));
+		}
+	}
+	if (subs.count > 0) {
+		sample_buffer_drop(delivered);
+	}
+	release_subscribers(&subs);
+}
+
+/**
+ * @brief Flushes buffered sensor samples via BLE notifications
+ * 
+ * This function transmits the samples waiting in the sample buffer to the
+ * subscribed BLE clients using GATT notifications. Each notification is a
+ * frame in the format selected by CONFIG_LIONK_DATA_FORMAT (see encoding.h)
+ * and packs as many samples as the negotiated ATT MTU allows. Every
+ * subscriber keeps its own position in the buffer and reporting period: a
+ * report is started for a subscriber once its period elapsed, or with no
+ * period once sample_buffer_flush_due() says so. Subscribers due at the same
+ * position share each encoded frame. The report itself is sent from the
+ * system work queue with up to CONFIG_LIONK_NOTIFY_FRAMES notifications in
+ * flight, and resumes as the stack completes them. Samples are removed from
+ * the buffer once the stack confirmed every subscriber has them; under
+ * backpressure they stay buffered.
+ * 
+ * @param now Current time in seconds since boot
+ * @return 0 on success, -EACCES if not subscribed, or -ENOTCONN if no
+ *         subscribed central is connected
+ */
+int ble_send_data(uint32_t now)
+{
+	subscribers_t subs;
+	bool reporting = false;
+
 	if (!subscribed) {
 		return -EACCES;
 	}
-	uint8_t buffer[5];
 
-	build_sensor_data_buffer(&sensor_data, buffer, sizeof(buffer));
-	return bt_gatt_notify(current_connection,
-			      &data_svc.attrs[data_svc.attr_count - 2], buffer,
-			      sizeof(buffer));
+	gather_subscribers(&subs, now);
+	if (subs.count == 0) {
+		return -ENOTCONN;
+	}
+	for (size_t i = 0; i < subs.count; i++) {
+		connection_ctx_t *ctx = context(subs.conns[i]);
+		if (!ctx->flushing && report_due(ctx, now)) {
+			ctx->flushing = true;
+		}
+		/* Also retries a report left out by a failed notification */
+		reporting |= ctx->flushing;
+	}
+	release_subscribers(&subs);
+
+	if (reporting) {
+		k_work_reschedule(&send_work, K_NO_WAIT);
+	}
+	return 0;
 }
 
 /**
  * @brief Checks if a BLE connection is currently active
  * 
- * This function returns the current BLE connection status by checking
- * if there is an active connection reference stored. This can be used
- * to determine if sensor data transmission is possible.
+ * This function returns whether at least one central device is connected,
+ * as counted by the connection callbacks. Up to CONFIG_BT_MAX_CONN centrals
+ * can be connected at the same time.
  * 
  * @return true if connected to a BLE central device, false otherwise
  */
 bool ble_is_connected(void)
 {
-	return current_connection != NULL;
+	return atomic_get(&connection_count) > 0;
 }
@@ -1,5 +1,7 @@
 #include <stdbool.h>
+#include <zephyr/bluetooth/conn.h>
 #include <zephyr/bluetooth/uuid.h>
+#include "sensor.h"
 
 #ifndef BLE_H
 
@@ -29,6 +31,68 @@
 #define BT_UUID_DATA_CCC_VAL \
 	BT_UUID_128_ENCODE(0x00000009, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
 
+#define BT_UUID_HISTORY_SVC_VAL \
+	BT_UUID_128_ENCODE(0x0000000a, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_HISTORY_CTRL_VAL \
+	BT_UUID_128_ENCODE(0x0000000b, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_PAWR_SVC_VAL \
+	BT_UUID_128_ENCODE(0x0000000c, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_PAWR_TIMING_VAL \
+	BT_UUID_128_ENCODE(0x0000000d, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_SAMPLING_SVC_VAL \
+	BT_UUID_128_ENCODE(0x0000000e, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_SAMPLING_BOUNDS_VAL \
+	BT_UUID_128_ENCODE(0x0000000f, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_CHANNEL_SVC_VAL \
+	BT_UUID_128_ENCODE(0x00000010, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_CALIBRATION_SVC_VAL \
+	BT_UUID_128_ENCODE(0x00000011, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_CALIBRATION_VAL \
+	BT_UUID_128_ENCODE(0x00000012, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_BURST_SVC_VAL \
+	BT_UUID_128_ENCODE(0x00000013, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_BURST_CTRL_VAL \
+	BT_UUID_128_ENCODE(0x00000014, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_BURST_DATA_VAL \
+	BT_UUID_128_ENCODE(0x00000015, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_POWER_SVC_VAL \
+	BT_UUID_128_ENCODE(0x00000016, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_POWER_STATS_VAL \
+	BT_UUID_128_ENCODE(0x00000017, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_REPORT_PERIOD_VAL \
+	BT_UUID_128_ENCODE(0x00000018, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_LINK_SVC_VAL \
+	BT_UUID_128_ENCODE(0x00000019, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_LINK_STATUS_VAL \
+	BT_UUID_128_ENCODE(0x0000001a, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_STATS_SVC_VAL \
+	BT_UUID_128_ENCODE(0x0000001b, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+#define BT_UUID_STATS_VAL \
+	BT_UUID_128_ENCODE(0x0000001c, 0x7669, 0x6163, 0x616d, 0x2d63616c6563)
+
+/* Characteristic of the n-th zephyr,user io-channel in the channel service */
+#define BT_UUID_CHANNEL_VAL(n)                                       \
+	BT_UUID_128_ENCODE(0x00000100 + (n), 0x7669, 0x6163, 0x616d, \
+			   0x2d63616c6563)
+
 #define BT_UUID_BATTERY_SVC	BT_UUID_DECLARE_128(BT_UUID_BATTERY_SVC_VAL)
 #define BT_UUID_BATTERY		BT_UUID_DECLARE_128(BT_UUID_BATTERY_VAL)
 #define BT_UUID_TEMPERATURE_SVC BT_UUID_DECLARE_128(BT_UUID_TEMPERATURE_SVC_VAL)
@@ -37,6 +101,26 @@
 #define BT_UUID_DATA_CCC	BT_UUID_DECLARE_128(BT_UUID_DATA_CCC_VAL)
 #define BT_UUID_VERSION_SVC	BT_UUID_DECLARE_128(BT_UUID_VERSION_SVC_VAL)
 #define BT_UUID_VERSION		BT_UUID_DECLARE_128(BT_UUID_VERSION_VAL)
+#define BT_UUID_HISTORY_SVC	BT_UUID_DECLARE_128(BT_UUID_HISTORY_SVC_VAL)
+#define BT_UUID_HISTORY_CTRL	BT_UUID_DECLARE_128(BT_UUID_HISTORY_CTRL_VAL)
+#define BT_UUID_PAWR_SVC	BT_UUID_DECLARE_128(BT_UUID_PAWR_SVC_VAL)
+#define BT_UUID_PAWR_TIMING	BT_UUID_DECLARE_128(BT_UUID_PAWR_TIMING_VAL)
+#define BT_UUID_SAMPLING_SVC	BT_UUID_DECLARE_128(BT_UUID_SAMPLING_SVC_VAL)
+#define BT_UUID_SAMPLING_BOUNDS BT_UUID_DECLARE_128(BT_UUID_SAMPLING_BOUNDS_VAL)
+#define BT_UUID_CHANNEL_SVC	BT_UUID_DECLARE_128(BT_UUID_CHANNEL_SVC_VAL)
+#define BT_UUID_CHANNEL(n)	BT_UUID_DECLARE_128(BT_UUID_CHANNEL_VAL(n))
+#define BT_UUID_CALIBRATION_SVC BT_UUID_DECLARE_128(BT_UUID_CALIBRATION_SVC_VAL)
+#define BT_UUID_CALIBRATION	BT_UUID_DECLARE_128(BT_UUID_CALIBRATION_VAL)
+#define BT_UUID_BURST_SVC	BT_UUID_DECLARE_128(BT_UUID_BURST_SVC_VAL)
+#define BT_UUID_BURST_CTRL	BT_UUID_DECLARE_128(BT_UUID_BURST_CTRL_VAL)
+#define BT_UUID_BURST_DATA	BT_UUID_DECLARE_128(BT_UUID_BURST_DATA_VAL)
+#define BT_UUID_POWER_SVC	BT_UUID_DECLARE_128(BT_UUID_POWER_SVC_VAL)
+#define BT_UUID_POWER_STATS	BT_UUID_DECLARE_128(BT_UUID_POWER_STATS_VAL)
+#define BT_UUID_REPORT_PERIOD	BT_UUID_DECLARE_128(BT_UUID_REPORT_PERIOD_VAL)
+#define BT_UUID_LINK_SVC	BT_UUID_DECLARE_128(BT_UUID_LINK_SVC_VAL)
+#define BT_UUID_LINK_STATUS	BT_UUID_DECLARE_128(BT_UUID_LINK_STATUS_VAL)
+#define BT_UUID_STATS_SVC	BT_UUID_DECLARE_128(BT_UUID_STATS_SVC_VAL)
+#define BT_UUID_STATS		BT_UUID_DECLARE_128(BT_UUID_STATS_VAL)
 
 /**
  * @brief Initializes the BLE subsystem and configures device settings
@@ -47,50 +131,86 @@
  * - Enabling Bluetooth with default configuration
  * - Loading stored settings from flash
  * - Setting the device name for advertising
+ * - Starting the connection state machine, which advertises right away
  * 
  * This must be called before any other BLE operations.
  */
 void ble_setup(void);
 
 /**
- * @brief Starts BLE advertising to make device discoverable
+ * @brief Re-evaluates the connection state machine
+ * 
+ * The state machine (idle, advertising, connected) runs on the system
+ * work queue and advances on the Bluetooth events themselves, so the
+ * device advertises again as soon as a connection is released, with no
+ * relation to the sampling period. This function queues an update for
+ * events the state machine cannot observe, such as a PAwR synchronization
+ * gained or lost. Can be called from any thread.
+ */
+void ble_update_state(void);
+
+/**
+ * @brief Asks for a short connection interval on a connection
+ * 
+ * Called before a bulk download or a burst stream. Every call must be
+ * balanced by ble_release_throughput(). Can be called from any thread.
+ * 
+ * @param conn BLE connection handle
+ */
+void ble_request_throughput(struct bt_conn *conn);
+
+/**
+ * @brief Lets a connection idle again after a transfer
  * 
- * This function begins broadcasting advertising packets containing the device
- * name and service flags. Central devices can discover and connect to this
- * peripheral while advertising is active.
+ * Once the last user released it, the connection falls back to the idle
+ * parameters. Can be called from any thread.
  * 
- * @return 0 on success, negative error code on failure
+ * @param conn BLE connection handle
  */
-int ble_start_advertising(void);
+void ble_release_throughput(struct bt_conn *conn);
 
 /**
- * @brief Stops BLE advertising to make device non-discoverable
+ * @brief Publishes the latest reading in the broadcast advertising set
  * 
- * This function stops broadcasting advertising packets, making the device
- * no longer discoverable by central devices. Existing connections remain
- * active.
+ * When CONFIG_LIONK_BROADCAST is enabled, this function updates in place the
+ * service data of the extended advertising set broadcast on LE Coded PHY,
+ * so passive scanners collect readings without connecting. The service data
+ * holds the data service UUID followed by the reading packed by
+ * encoding_put_reading(), from a consistent copy of the latest sample set
+ * whose sequence number numbers the reading.
  * 
- * @return 0 on success, negative error code on failure
+ * @return 0 on success or if broadcasting is disabled, negative error code
+ *         on failure
  */
-int ble_stop_advertising(void);
+int ble_broadcast_update(void);
 
 /**
- * @brief Sends current sensor data via BLE notification
+ * @brief Flushes buffered sensor samples via BLE notifications
  * 
- * This function transmits the current temperature and battery readings
- * to a connected BLE client using GATT notifications. The data is only
- * sent if a client is connected and has subscribed to notifications.
+ * This function transmits the samples waiting in the sample buffer to the
+ * subscribed BLE clients using GATT notifications. Each notification is a
+ * frame in the format selected by CONFIG_LIONK_DATA_FORMAT (see encoding.h)
+ * and packs as many samples as the negotiated ATT MTU allows. Every
+ * subscriber keeps its own position in the buffer and reporting period: a
+ * report is started for a subscriber once its period elapsed, or with no
+ * period once sample_buffer_flush_due() says so. Subscribers due at the same
+ * position share each encoded frame. The report itself is sent from the
+ * system work queue with up to CONFIG_LIONK_NOTIFY_FRAMES notifications in
+ * flight, and resumes as the stack completes them. Samples are removed from
+ * the buffer once the stack confirmed every subscriber has them; under
+ * backpressure they stay buffered.
  * 
- * @return 0 on success, -EACCES if not subscribed, or other negative error code
+ * @param now Current time in seconds since boot
+ * @return 0 on success, -EACCES if not subscribed, or -ENOTCONN if no
+ *         subscribed central is connected
  */
-int ble_send_data(void);
+int ble_send_data(uint32_t now);
 
 /**
  * @brief Checks if a BLE connection is currently active
  * 
- * This function returns the current BLE connection status by checking
- * if there is an active connection reference stored. This can be used
- * to determine if sensor data transmission is possible.
+ * This function returns whether at least one central device is connected.
+ * Up to CONFIG_BT_MAX_CONN centrals can be connected at the same time.
  * 
  * @return true if connected to a BLE central device, false otherwise
  */
@@ -99,9 +219,10 @@ bool ble_is_connected(void);
 /**
  * @brief Checks if a BLE client has subscribed to data notifications
  * 
- * This function returns the current subscription status for the data
- * characteristic. Data notifications are only sent when a client has
- * enabled them by writing to the Client Characteristic Configuration.
+ * This function returns whether at least one connected client subscribed
+ * to the data characteristic. Data notifications are only sent when a
+ * client has enabled them by writing to the Client Characteristic
+ * Configuration.
  * 
  * @return true if notifications are enabled, false otherwise
  */
@@ -0,0 +1,273 @@
+#include "bulk.h"
+#include "ble.h"
+#include "history.h"
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/l2cap.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/buf.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+
+LOG_MODULE_REGISTER(bulk, LOG_LEVEL_INF);
+
+/* Size of a download request, the sequence number to start from */
+#define BULK_REQUEST_SIZE 4
+/* Smallest MTU allowed for a connection oriented channel */
+#define BULK_RX_MTU	  23
+
+#define BULK_SDU_MAX	  1024
+#define BULK_HEADER_SIZE  8
+#define BULK_RECORD_SIZE  8
+#define BULK_MAX_RECORDS  ((BULK_SDU_MAX - BULK_HEADER_SIZE) / BULK_RECORD_SIZE)
+
+/* Number of SDUs that can be queued in the stack at the same time */
+#define BULK_TX_BUFFERS	  2
+
+enum {
+	BULK_CONNECTED,
+	BULK_REQUEST_PENDING,
+};
+
+static ssize_t read_control(struct bt_conn *conn,
+			    const struct bt_gatt_attr *attr, void *buf,
+			    uint16_t len, uint16_t offset);
+static void stream_history(struct k_work *work);
+
+NET_BUF_POOL_FIXED_DEFINE(bulk_tx_pool, BULK_TX_BUFFERS,
+			  BT_L2CAP_SDU_BUF_SIZE(BULK_SDU_MAX),
+			  CONFIG_BT_CONN_TX_USER_DATA_SIZE, NULL);
+
+K_WORK_DEFINE(stream_work, stream_history);
+
+BT_GATT_SERVICE_DEFINE(history_svc,
+		       BT_GATT_PRIMARY_SERVICE(BT_UUID_HISTORY_SVC),
+		       BT_GATT_CHARACTERISTIC(BT_UUID_HISTORY_CTRL,
+					      BT_GATT_CHRC_READ,
+					      BT_GATT_PERM_READ, read_control,
+					      NULL, NULL));
+
+static struct bt_l2cap_le_chan bulk_chan;
+static ATOMIC_DEFINE(bulk_flags, 2);
+static uint32_t requested_seq;
+
+/* Only accessed from the system work queue */
+static bool streaming;
+static uint32_t stream_seq;
+
+/**
+ * @brief Sends the next part of the requested history
+ * 
+ * Runs on the system work queue, where the history log is owned. Queues
+ * SDUs as long as transmit buffers are available; the sent callback
+ * resubmits this work once the gateway granted credits and an SDU left.
+ * 
+ * @param work Pointer to the work structure (unused)
+ */
+static void stream_history(struct k_work *work)
+{
+	static sensor_sample_t samples[BULK_MAX_RECORDS];
+
+	(void)work;
+	if (!atomic_test_bit(bulk_flags, BULK_CONNECTED)) {
+		streaming = false;
+		return;
+	}
+	if (atomic_test_and_clear_bit(bulk_flags, BULK_REQUEST_PENDING)) {
+		stream_seq = requested_seq;
+		streaming = true;
+		LOG_INF("History download from sequence %u", stream_seq);
+	}
+
+	while (streaming) {
+		struct net_buf *buf = net_buf_alloc(&bulk_tx_pool, K_NO_WAIT);
+		if (!buf) {
+			return;
+		}
+		net_buf_reserve(buf, BT_L2CAP_SDU_CHAN_SEND_RESERVE);
+
+		size_t max = (MIN(bulk_chan.tx.mtu, BULK_SDU_MAX) -
+			      BULK_HEADER_SIZE) /
+			     BULK_RECORD_SIZE;
+		uint32_t first_seq;
+		uint16_t boot;
+		size_t count = history_read(stream_seq, samples,
+					    MIN(max, ARRAY_SIZE(samples)),
+					    &first_seq, &boot);
+
+		net_buf_add_be32(buf, first_seq);
+		net_buf_add_be16(buf, count);
+		net_buf_add_be16(buf, boot);
+		for (size_t i = 0; i < count; i++) {
+			const uint16_t *values = samples[i].data.values;
+
+			net_buf_add_be32(buf, samples[i].timestamp);
+			net_buf_add_be16(buf, values[TEMPERATURE_CHANNEL]);
+			net_buf_add_be16(buf, values[BATTERY_CHANNEL]);
+		}
+
+		int err = bt_l2cap_chan_send(&bulk_chan.chan, buf);
+		if (err < 0) {
+			LOG_ERR("Couldn't send history (%d)", err);
+			net_buf_unref(buf);
+			streaming = false;
+			return;
+		}
+
+		stream_seq = first_seq + count;
+		if (count == 0) {
+			LOG_INF("History download complete at sequence %u",
+				stream_seq);
+			streaming = false;
+		}
+	}
+}
+
+/**
+ * @brief Callback function called when the bulk channel is connected
+ * 
+ * The gateway opens the channel to download, so a short connection
+ * interval is requested until it closes it.
+ * 
+ * @param chan L2CAP channel
+ */
+static void bulk_connected(struct bt_l2cap_chan *chan)
+{
+	atomic_set_bit(bulk_flags, BULK_CONNECTED);
+	ble_request_throughput(chan->conn);
+	LOG_INF("Bulk channel connected, tx MTU %u", bulk_chan.tx.mtu);
+}
+
+/**
+ * @brief Callback function called when the bulk channel is disconnected
+ * 
+ * Stops the current download; the gateway resumes it on a new channel.
+ * The connection goes back to idle parameters.
+ * 
+ * @param chan L2CAP channel
+ */
+static void bulk_disconnected(struct bt_l2cap_chan *chan)
+{
+	atomic_clear_bit(bulk_flags, BULK_CONNECTED);
+	atomic_clear_bit(bulk_flags, BULK_REQUEST_PENDING);
+	ble_release_throughput(chan->conn);
+	k_work_submit(&stream_work);
+	LOG_INF("Bulk channel disconnected");
+}
+
+/**
+ * @brief Callback function called when a download request is received
+ * 
+ * A request restarts the download from the requested sequence number, even
+ * if a previous download is still running.
+ * 
+ * @param chan L2CAP channel
+ * @param buf Received SDU
+ * @return 0 on success, -EINVAL if the request is malformed
+ */
+static int bulk_recv(struct bt_l2cap_chan *chan, struct net_buf *buf)
+{
+	if (buf->len != BULK_REQUEST_SIZE) {
+		LOG_WRN("Invalid history request of %u bytes", buf->len);
+		return -EINVAL;
+	}
+
+	requested_seq = net_buf_pull_be32(buf);
+	atomic_set_bit(bulk_flags, BULK_REQUEST_PENDING);
+	k_work_submit(&stream_work);
+	return 0;
+}
+
+/**
+ * @brief Callback function called when an SDU has been sent
+ * 
+ * @param chan L2CAP channel
+ */
+static void bulk_sent(struct bt_l2cap_chan *chan)
+{
+	k_work_submit(&stream_work);
+}
+
+static const struct bt_l2cap_chan_ops bulk_ops = {
+	.connected = bulk_connected,
+	.disconnected = bulk_disconnected,
+	.recv = bulk_recv,
+	.sent = bulk_sent,
+};
+
+/**
+ * @brief Accepts an incoming bulk channel
+ * 
+ * Only one download channel is served at a time.
+ * 
+ * @param conn BLE connection handle
+ * @param server L2CAP server
+ * @param chan Set to the channel to use
+ * @return 0 on success, -ENOMEM if a channel is already open
+ */
+static int bulk_accept(struct bt_conn *conn, struct bt_l2cap_server *server,
+		       struct bt_l2cap_chan **chan)
+{
+	if (bulk_chan.chan.conn) {
+		return -ENOMEM;
+	}
+
+	bulk_chan.chan.ops = &bulk_ops;
+	bulk_chan.rx.mtu = BULK_RX_MTU;
+	*chan = &bulk_chan.chan;
+	return 0;
+}
+
+static struct bt_l2cap_server bulk_server = {
+	.sec_level = BT_SECURITY_L1,
+	.accept = bulk_accept,
+};
+
+/**
+ * @brief Reads the history control characteristic
+ * 
+ * Returns the PSM of the bulk download server (big-endian uint16), the
+ * sequence number of the next sample to be logged (big-endian uint32), then
+ * the boot counter of the current boot (big-endian uint16).
+ * 
+ * @param conn BLE connection handle
+ * @param attr GATT attribute being read
+ * @param buf Buffer to store the response
+ * @param len Maximum length of the response
+ * @param offset Offset for partial reads
+ * @return Number of bytes written to the buffer
+ */
+static ssize_t read_control(struct bt_conn *conn,
+			    const struct bt_gatt_attr *attr, void *buf,
+			    uint16_t len, uint16_t offset)
+{
+	uint8_t value[8];
+
+	sys_put_be16(bulk_server.psm, &value[0]);
+	sys_put_be32(history_next_seq(), &value[2]);
+	sys_put_be16(history_boot_count(), &value[6]);
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, value,
+				 sizeof(value));
+}
+
+/**
+ * @brief Registers the L2CAP server used for bulk history download
+ * 
+ * The PSM is allocated dynamically and published through the history
+ * control characteristic. This must be called after the Bluetooth stack is
+ * enabled.
+ * 
+ * @return 0 on success, negative error code on failure
+ */
+int bulk_init(void)
+{
+	int err = bt_l2cap_server_register(&bulk_server);
+	if (err) {
+		LOG_ERR("Couldn't register L2CAP server (%d)", err);
+		return err;
+	}
+	LOG_INF("History download on PSM 0x%04x", bulk_server.psm);
+	return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef BULK_H
+#define BULK_H
+
+/**
+ * @brief Registers the L2CAP server used for bulk history download
+ * 
+ * A gateway reads the history control characteristic to learn the PSM of
+ * the server, the next sequence number and the boot counter, opens an L2CAP
+ * connection oriented channel on that PSM, and sends a 4-byte big-endian
+ * sequence number. The device then streams the history log from that sequence number
+ * onward, one SDU at a time, paced by the credits granted by the gateway:
+ * - Bytes 0-3: Sequence number of the first sample (big-endian uint32)
+ * - Bytes 4-5: Number of samples in the SDU (big-endian uint16)
+ * - Bytes 6-7: Boot counter of the samples (big-endian uint16), as their
+ *   timestamps are seconds since that boot
+ * - Then, for each sample, an 8-byte record laid out like the records of
+ *   the data characteristic
+ * 
+ * The stream ends with an SDU holding no sample, whose sequence number is
+ * the next one to be logged. A download interrupted by a disconnection is
+ * resumed by requesting the sequence number following the last one received.
+ * 
+ * This must be called after the Bluetooth stack is enabled.
+ * 
+ * @return 0 on success, negative error code on failure
+ */
+int bulk_init(void);
+
+#endif
@@ -0,0 +1,312 @@
+#include "ble.h"
+#include "channels.h"
+#include "lionk_adc.h"
+#include "sampler.h"
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+
+LOG_MODULE_REGISTER(burst, LOG_LEVEL_INF);
+
+/*
+ * Burst capture, for transient diagnostics such as a door opening.
+ * 
+ * The gateway subscribes to the burst data characteristic, then writes the
+ * burst control characteristic:
+ * - Byte 0: Index of the channel in the zephyr,user io-channels
+ * - Bytes 1-2: Sampling rate in Hz (big-endian uint16)
+ * - Bytes 3-4: Number of samples (big-endian uint16)
+ * 
+ * Reading the burst control characteristic returns the largest number of
+ * samples then the highest rate (big-endian uint16 each).
+ * 
+ * The samples are notified on the burst data characteristic while they are
+ * captured, as many per notification as the ATT MTU allows:
+ * - Bytes 0-1: Index of the first sample in the burst (big-endian uint16)
+ * - Then, for each sample, its value in mV (big-endian int16)
+ * 
+ * A notification holding only the index ends the burst; the index is the
+ * number of samples captured, fewer than requested if the capture failed.
+ */
+
+#define BURST_REQUEST_SIZE     5
+#define BURST_HEADER_SIZE      2
+#define BURST_SAMPLE_SIZE      2
+#define ATT_NOTIFY_HEADER_SIZE 3
+
+/* Notification payload with a 247-byte ATT MTU */
+#define BURST_FRAME_MAX	       244
+
+/* Delay before retrying a notification when the stack is out of buffers */
+#define BURST_RETRY	       K_MSEC(10)
+
+enum {
+	BURST_BUSY,	// From the request to the end of the stream
+	BURST_CAPTURED, // The capture completed
+};
+
+static ssize_t read_control(struct bt_conn *conn,
+			    const struct bt_gatt_attr *attr, void *buf,
+			    uint16_t len, uint16_t offset);
+static ssize_t write_control(struct bt_conn *conn,
+			     const struct bt_gatt_attr *attr, const void *buf,
+			     uint16_t len, uint16_t offset, uint8_t flags);
+static void stream_burst(struct k_work *work);
+
+BT_GATT_SERVICE_DEFINE(burst_svc, BT_GATT_PRIMARY_SERVICE(BT_UUID_BURST_SVC),
+		       BT_GATT_CHARACTERISTIC(BT_UUID_BURST_CTRL,
+					      BT_GATT_CHRC_READ |
+						      BT_GATT_CHRC_WRITE,
+					      BT_GATT_PERM_READ |
+						      BT_GATT_PERM_WRITE,
+					      read_control, write_control,
+					      NULL),
+		       BT_GATT_CHARACTERISTIC(BT_UUID_BURST_DATA,
+					      BT_GATT_CHRC_NOTIFY,
+					      BT_GATT_PERM_NONE, NULL, NULL,
+					      NULL),
+		       BT_GATT_CCC(NULL,
+				   BT_GATT_PERM_READ | BT_GATT_PERM_WRITE));
+
+K_WORK_DELAYABLE_DEFINE(stream_work, stream_burst);
+
+static int16_t samples[CONFIG_LIONK_BURST_MAX_SAMPLES];
+static ATOMIC_DEFINE(burst_flags, 2);
+static atomic_t captured;
+
+/* Set by the request, then only accessed from the system work queue */
+static struct bt_conn *stream_conn;
+static size_t stream_channel;
+static size_t frame_samples;
+static size_t sent;
+
+/**
+ * @brief Counts the samples stored by the ADC
+ * 
+ * Invoked by the ADC driver after each sample of the burst. Wakes the
+ * stream up once a full notification is waiting.
+ * 
+ * @param dev ADC device (unused)
+ * @param sequence Running sequence (unused)
+ * @param sampling_index Index of the sample just stored
+ * @return ADC_ACTION_CONTINUE
+ */
+static enum adc_action burst_progress(const struct device *dev,
+				      const struct adc_sequence *sequence,
+				      uint16_t sampling_index)
+{
+	size_t count = sampling_index + 1;
+
+	atomic_set(&captured, count);
+	if (count % frame_samples == 0) {
+		k_work_reschedule(&stream_work, K_NO_WAIT);
+	}
+	return ADC_ACTION_CONTINUE;
+}
+
+/**
+ * @brief Called by the sampler when the capture completed
+ * 
+ * @param err 0 on success, negative error code if the capture failed
+ */
+static void burst_done(int err)
+{
+	if (err) {
+		LOG_ERR("Burst capture failed after %ld samples (%d)",
+			atomic_get(&captured), err);
+	}
+	atomic_set_bit(burst_flags, BURST_CAPTURED);
+	k_work_reschedule(&stream_work, K_NO_WAIT);
+}
+
+/**
+ * @brief Stops streaming to the central
+ * 
+ * The connection goes back to idle parameters.
+ */
+static void close_stream(void)
+{
+	if (stream_conn) {
+		ble_release_throughput(stream_conn);
+		bt_conn_unref(stream_conn);
+		stream_conn = NULL;
+	}
+}
+
+/**
+ * @brief Ends the stream and accepts a new request
+ */
+static void release_burst(void)
+{
+	close_stream();
+	atomic_clear_bit(burst_flags, BURST_BUSY);
+}
+
+/**
+ * @brief Notifies the captured samples not sent yet
+ * 
+ * Runs on the system work queue. Only full notifications are sent while
+ * the capture runs. Once it completed, the remaining samples and the end
+ * notification are sent, and a new burst can be requested. If the stream
+ * breaks, the capture still runs to its end before the burst is released.
+ * 
+ * @param work Pointer to the work structure (unused)
+ */
+static void stream_burst(struct k_work *work)
+{
+	static uint8_t frame[BURST_FRAME_MAX];
+
+	(void)work;
+	/* Test completion first, so no sample stored before it is missed */
+	bool complete = atomic_test_bit(burst_flags, BURST_CAPTURED);
+	size_t count = atomic_get(&captured);
+
+	while (stream_conn && sent < count) {
+		size_t n = MIN(count - sent, frame_samples);
+		if (n < frame_samples && !complete) {
+			return;
+		}
+
+		uint8_t *out = &frame[BURST_HEADER_SIZE];
+
+		sys_put_be16(sent, &frame[0]);
+		for (size_t i = 0; i < n; i++) {
+			sys_put_be16(lionk_adc_to_millivolts(stream_channel,
+							     samples[sent + i]),
+				     out);
+			out += BURST_SAMPLE_SIZE;
+		}
+
+		int err = bt_gatt_notify(
+			stream_conn, &burst_svc.attrs[4], frame,
+			BURST_HEADER_SIZE + n * BURST_SAMPLE_SIZE);
+		if (err == -ENOMEM) {
+			k_work_reschedule(&stream_work, BURST_RETRY);
+			return;
+		}
+		if (err) {
+			LOG_ERR("Couldn't send burst samples (%d)", err);
+			close_stream();
+			break;
+		}
+		sent += n;
+	}
+
+	if (!complete) {
+		return;
+	}
+	if (stream_conn) {
+		sys_put_be16(count, &frame[0]);
+		int err = bt_gatt_notify(stream_conn, &burst_svc.attrs[4],
+					 frame, BURST_HEADER_SIZE);
+		if (err == -ENOMEM) {
+			k_work_reschedule(&stream_work, BURST_RETRY);
+			return;
+		}
+	}
+	LOG_INF("Burst of %zu samples sent", sent);
+	release_burst();
+}
+
+/**
+ * @brief Reads the burst control characteristic
+ * 
+ * Returns the largest number of samples, then the highest sampling rate in
+ * Hz, as big-endian uint16 values.
+ * 
+ * @param conn BLE connection handle
+ * @param attr GATT attribute being read
+ * @param buf Buffer to store the read data
+ * @param len Maximum length of data to read
+ * @param offset Offset within the attribute value
+ * @return Number of bytes read, or negative error code on failure
+ */
+static ssize_t read_control(struct bt_conn *conn,
+			    const struct bt_gatt_attr *attr, void *buf,
+			    uint16_t len, uint16_t offset)
+{
+	uint8_t value[4];
+
+	sys_put_be16(CONFIG_LIONK_BURST_MAX_SAMPLES, &value[0]);
+	sys_put_be16(CONFIG_LIONK_BURST_MAX_RATE, &value[2]);
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, value,
+				 sizeof(value));
+}
+
+/**
+ * @brief Starts a burst capture requested by the gateway
+ * 
+ * The writing central must be subscribed to the burst data characteristic,
+ * and only one burst runs at a time.
+ * 
+ * @param conn BLE connection handle
+ * @param attr GATT attribute being written
+ * @param buf Written value: channel, rate and number of samples
+ * @param len Length of the written value
+ * @param offset Write offset
+ * @param flags Write flags
+ * @return Number of bytes written, or a negative ATT error code
+ */
+static ssize_t write_control(struct bt_conn *conn,
+			     const struct bt_gatt_attr *attr, const void *buf,
+			     uint16_t len, uint16_t offset, uint8_t flags)
+{
+	const uint8_t *value = buf;
+
+	if (offset) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+	if (len != BURST_REQUEST_SIZE) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	size_t channel = value[0];
+	uint16_t rate = sys_get_be16(&value[1]);
+	uint16_t count = sys_get_be16(&value[3]);
+
+	if (channel >= LIONK_CHANNEL_COUNT || rate == 0 ||
+	    rate > CONFIG_LIONK_BURST_MAX_RATE || count == 0 ||
+	    count > CONFIG_LIONK_BURST_MAX_SAMPLES) {
+		return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+	}
+	if (!bt_gatt_is_subscribed(conn, &burst_svc.attrs[4],
+				   BT_GATT_CCC_NOTIFY)) {
+		return BT_GATT_ERR(BT_ATT_ERR_CCC_IMPROPER_CONF);
+	}
+	if (atomic_test_and_set_bit(burst_flags, BURST_BUSY)) {
+		return BT_GATT_ERR(BT_ATT_ERR_PROCEDURE_IN_PROGRESS);
+	}
+
+	atomic_clear_bit(burst_flags, BURST_CAPTURED);
+	atomic_set(&captured, 0);
+	stream_conn = bt_conn_ref(conn);
+	ble_request_throughput(stream_conn);
+	stream_channel = channel;
+	sent = 0;
+	frame_samples = MIN(bt_gatt_get_mtu(conn) - ATT_NOTIFY_HEADER_SIZE,
+			    BURST_FRAME_MAX) -
+			BURST_HEADER_SIZE;
+	frame_samples /= BURST_SAMPLE_SIZE;
+
+	const sampler_burst_t burst = {
+		.channel = channel,
+		.interval_us = USEC_PER_SEC / rate,
+		.buffer = samples,
+		.count = count,
+		.progress = burst_progress,
+		.done = burst_done,
+	};
+	int err = sampler_request_burst(&burst);
+	if (err) {
+		LOG_ERR("Couldn't request burst (%d)", err);
+		release_burst();
+		return BT_GATT_ERR(BT_ATT_ERR_UNLIKELY);
+	}
+
+	LOG_INF("Burst of %u samples at %u Hz on channel %zu", count, rate,
+		channel);
+	return len;
+}
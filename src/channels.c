@@ -0,0 +1,29 @@
+#include "channels.h"
+
+BUILD_ASSERT(LIONK_CHANNEL_COUNT >= 2,
+	     "The first io-channels must be the temperature and the battery");
+BUILD_ASSERT(DT_PROP_LEN(LIONK_CHANNELS_NODE, enable_gpios) ==
+		     LIONK_CHANNEL_COUNT,
+	     "Every io-channel needs a resistor divider enable GPIO");
+
+#define LIONK_CHANNEL_INIT(node_id, prop, idx)                                 \
+	{                                                                      \
+		.name = DT_PROP_BY_IDX(node_id, io_channel_names, idx),        \
+		.divider_en =                                                  \
+			GPIO_DT_SPEC_GET_BY_IDX(node_id, enable_gpios, idx),   \
+		.settle_time_ms =                                              \
+			DT_PROP_BY_IDX(node_id, settle_times_ms, idx),         \
+		.default_period_ms =                                           \
+			DT_PROP_BY_IDX(node_id, sampling_periods_ms, idx),     \
+		.multiplier = (int32_t)DT_PROP_BY_IDX(                         \
+			node_id, conversion_multipliers, idx),                 \
+		.divisor = (int32_t)DT_PROP_BY_IDX(node_id,                    \
+						   conversion_divisors, idx),  \
+		.offset = (int32_t)DT_PROP_BY_IDX(node_id, conversion_offsets, \
+						  idx),                        \
+	},
+
+const lionk_channel_t lionk_channels[LIONK_CHANNEL_COUNT] = {
+	DT_FOREACH_PROP_ELEM(LIONK_CHANNELS_NODE, io_channels,
+			     LIONK_CHANNEL_INIT)
+};
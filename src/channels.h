@@ -0,0 +1,54 @@
+#ifndef CHANNELS_H
+#define CHANNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/gpio.h>
+
+/*
+ * The sensor channels are the io-channels of the zephyr,user node. Each
+ * channel also takes one element of the following zephyr,user properties:
+ * - io-channel-names: Name shown in the channel's GATT user description
+ * - enable-gpios: GPIO powering the channel's resistor divider
+ * - settle-times-ms: Time the divider needs to settle once powered
+ * - sampling-periods-ms: Sampling period until changed at runtime
+ * - conversion-multipliers, conversion-divisors, conversion-offsets: The
+ *   channel value is mv * multiplier / divisor + offset. The temperature
+ *   channel ignores them, see temperature.h
+ */
+#define LIONK_CHANNELS_NODE DT_PATH(zephyr_user)
+#define LIONK_CHANNEL_COUNT DT_PROP_LEN(LIONK_CHANNELS_NODE, io_channels)
+
+/* The first two channels have a fixed role, other probes follow them */
+#define TEMPERATURE_CHANNEL 0
+#define BATTERY_CHANNEL	    1
+
+/* Static description of a sensor channel, generated from the devicetree */
+typedef struct {
+	const char *name;
+	struct gpio_dt_spec divider_en; // Powers the channel's resistor divider
+	uint16_t settle_time_ms;	// Settle time of the resistor divider
+	uint32_t default_period_ms;	// Sampling period until changed
+	int32_t multiplier;
+	int32_t divisor;
+	int32_t offset;
+} lionk_channel_t;
+
+extern const lionk_channel_t lionk_channels[LIONK_CHANNEL_COUNT];
+
+/**
+ * @brief Converts the millivolt value of a channel to its unit
+ * 
+ * @param channel Index of the channel in the zephyr,user io-channels
+ * @param value_mv Millivolt value read on the channel
+ * @return Converted value
+ */
+static inline int32_t lionk_channel_convert(size_t channel, int32_t value_mv)
+{
+	const lionk_channel_t *spec = &lionk_channels[channel];
+
+	return value_mv * spec->multiplier / spec->divisor + spec->offset;
+}
+
+#endif
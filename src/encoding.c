@@ -0,0 +1,374 @@
+#include "encoding.h"
+#include <errno.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+/* Flags stored below the temperature delta of a delta-encoded sample */
+#define DELTA_FLAG_INTERVAL BIT(0)
+#define DELTA_FLAG_BATTERY  BIT(1)
+#define DELTA_FLAG_BITS	    2
+
+/* Longest varint needed for a 32-bit value */
+#define VARINT_MAX_SIZE	    5
+
+/**
+ * @brief Maps a signed value to an unsigned one, small magnitudes first
+ * 
+ * @param value Signed value
+ * @return Zig-zag encoded value
+ */
+static uint32_t zigzag_encode(int32_t value)
+{
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+/**
+ * @brief Reverts zigzag_encode()
+ * 
+ * @param value Zig-zag encoded value
+ * @return Signed value
+ */
+static int32_t zigzag_decode(uint32_t value)
+{
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+/**
+ * @brief Writes a varint
+ * 
+ * @param value Value to write
+ * @param buf Output buffer of at least VARINT_MAX_SIZE bytes
+ * @return Number of bytes written
+ */
+static size_t varint_put(uint32_t value, uint8_t *buf)
+{
+	size_t len = 0;
+
+	while (value >= 0x80) {
+		buf[len++] = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+	buf[len++] = value;
+	return len;
+}
+
+/**
+ * @brief Reads a varint
+ * 
+ * @param buf Input buffer
+ * @param len Number of bytes available
+ * @param value Set to the decoded value
+ * @return Number of bytes read, or -EINVAL if the varint is truncated
+ */
+static int varint_get(const uint8_t *buf, size_t len, uint32_t *value)
+{
+	*value = 0;
+	for (size_t i = 0; i < MIN(len, VARINT_MAX_SIZE); i++) {
+		*value |= (uint32_t)(buf[i] & 0x7F) << (7 * i);
+		if (!(buf[i] & 0x80)) {
+			return i + 1;
+		}
+	}
+	return -EINVAL;
+}
+
+/**
+ * @brief Writes a sample as a fixed 8-byte record
+ * 
+ * @param sample Sample to write
+ * @param buf Output buffer of at least ENCODING_RECORD_SIZE bytes
+ */
+static void put_record(const sensor_sample_t *sample, uint8_t *buf)
+{
+	sys_put_be32(sample->timestamp, &buf[0]);
+	sys_put_be16(sample->data.values[TEMPERATURE_CHANNEL], &buf[4]);
+	sys_put_be16(sample->data.values[BATTERY_CHANNEL], &buf[6]);
+}
+
+/**
+ * @brief Reads a sample from a fixed 8-byte record
+ * 
+ * @param buf Input buffer of at least ENCODING_RECORD_SIZE bytes
+ * @param sample Set to the decoded sample
+ */
+static void get_record(const uint8_t *buf, sensor_sample_t *sample)
+{
+	sample->timestamp = sys_get_be32(&buf[0]);
+	sample->data.values[TEMPERATURE_CHANNEL] = sys_get_be16(&buf[4]);
+	sample->data.values[BATTERY_CHANNEL] = sys_get_be16(&buf[6]);
+}
+
+/**
+ * @brief Packs the latest reading for connectionless transfer
+ * 
+ * Used by the broadcast advertising data and the PAwR responses:
+ * - Byte 0: Format version (always 0)
+ * - Bytes 1-2: Rolling sequence counter (big-endian uint16)
+ * - Bytes 3-4: Temperature in centi-degrees Celsius (big-endian int16)
+ * - Bytes 5-6: Battery voltage in mV (big-endian uint16)
+ * 
+ * @param seq Rolling sequence counter of the reading
+ * @param data Latest sensor reading
+ * @param buf Output buffer of at least ENCODING_READING_SIZE bytes
+ */
+void encoding_put_reading(uint16_t seq, const sensor_data_t *data,
+			  uint8_t *buf)
+{
+	buf[0] = 0;
+	sys_put_be16(seq, &buf[1]);
+	sys_put_be16(data->values[TEMPERATURE_CHANNEL], &buf[3]);
+	sys_put_be16(data->values[BATTERY_CHANNEL], &buf[5]);
+}
+
+/**
+ * @brief Encodes the first sample in the legacy format
+ * 
+ * @param sample Sample to encode
+ * @param buf Output buffer of at least ENCODING_LEGACY_SIZE bytes
+ * @param len Set to the number of bytes written
+ * @return Number of samples encoded, always 1
+ */
+static size_t encode_legacy(const sensor_sample_t *sample, uint8_t *buf,
+			    size_t *len)
+{
+	buf[0] = ENCODING_FORMAT_LEGACY;
+	sys_put_be16(sample->data.values[TEMPERATURE_CHANNEL], &buf[1]);
+	sys_put_be16(sample->data.values[BATTERY_CHANNEL], &buf[3]);
+	*len = ENCODING_LEGACY_SIZE;
+	return 1;
+}
+
+/**
+ * @brief Encodes samples in the fixed format
+ * 
+ * @param samples Samples to encode, oldest first
+ * @param count Number of samples, at least 1
+ * @param buf Output buffer
+ * @param size Size of the output buffer, enough for one record
+ * @param len Set to the number of bytes written
+ * @return Number of samples encoded
+ */
+static size_t encode_fixed(const sensor_sample_t *samples, size_t count,
+			   uint8_t *buf, size_t size, size_t *len)
+{
+	size_t n = MIN(count, (size - ENCODING_HEADER_SIZE) /
+				      ENCODING_RECORD_SIZE);
+
+	buf[0] = ENCODING_FORMAT_FIXED;
+	for (size_t i = 0; i < n; i++) {
+		put_record(&samples[i], &buf[ENCODING_HEADER_SIZE +
+					     i * ENCODING_RECORD_SIZE]);
+	}
+	*len = ENCODING_HEADER_SIZE + n * ENCODING_RECORD_SIZE;
+	return n;
+}
+
+/**
+ * @brief Encodes samples in the delta format
+ * 
+ * @param samples Samples to encode, oldest first
+ * @param count Number of samples, at least 1
+ * @param buf Output buffer
+ * @param size Size of the output buffer, enough for one record
+ * @param len Set to the number of bytes written
+ * @return Number of samples encoded
+ */
+static size_t encode_delta(const sensor_sample_t *samples, size_t count,
+			   uint8_t *buf, size_t size, size_t *len)
+{
+	size_t pos = ENCODING_HEADER_SIZE + ENCODING_RECORD_SIZE;
+	int32_t prev_interval = 0;
+	size_t n;
+
+	buf[0] = ENCODING_FORMAT_DELTA;
+	put_record(&samples[0], &buf[ENCODING_HEADER_SIZE]);
+
+	for (n = 1; n < count; n++) {
+		const sensor_sample_t *prev = &samples[n - 1];
+		const sensor_sample_t *cur = &samples[n];
+		int32_t interval = (int32_t)(cur->timestamp - prev->timestamp);
+		int32_t interval_change = interval - prev_interval;
+		int16_t temperature_delta =
+			(int16_t)(cur->data.values[TEMPERATURE_CHANNEL] -
+				  prev->data.values[TEMPERATURE_CHANNEL]);
+		int16_t battery_delta =
+			(int16_t)(cur->data.values[BATTERY_CHANNEL] -
+				  prev->data.values[BATTERY_CHANNEL]);
+		uint8_t tmp[3 * VARINT_MAX_SIZE];
+		uint32_t head = zigzag_encode(temperature_delta)
+				<< DELTA_FLAG_BITS;
+		size_t tmp_len;
+
+		if (interval_change) {
+			head |= DELTA_FLAG_INTERVAL;
+		}
+		if (battery_delta) {
+			head |= DELTA_FLAG_BATTERY;
+		}
+		tmp_len = varint_put(head, tmp);
+		if (interval_change) {
+			tmp_len += varint_put(zigzag_encode(interval_change),
+					      &tmp[tmp_len]);
+		}
+		if (battery_delta) {
+			tmp_len += varint_put(zigzag_encode(battery_delta),
+					      &tmp[tmp_len]);
+		}
+
+		if (pos + tmp_len > size) {
+			break;
+		}
+		memcpy(&buf[pos], tmp, tmp_len);
+		pos += tmp_len;
+		prev_interval = interval;
+	}
+	*len = pos;
+	return n;
+}
+
+/**
+ * @brief Encodes as many samples as fit in a buffer
+ * 
+ * @param format Frame format to use
+ * @param samples Samples to encode, oldest first
+ * @param count Number of samples
+ * @param buf Output buffer
+ * @param size Size of the output buffer
+ * @param len Set to the number of bytes written
+ * @return Number of samples encoded, 0 if the buffer cannot hold one sample;
+ *         at most 1 in the legacy format
+ */
+size_t encoding_encode(encoding_format_t format,
+		       const sensor_sample_t *samples, size_t count,
+		       uint8_t *buf, size_t size, size_t *len)
+{
+	*len = 0;
+	if (count == 0) {
+		return 0;
+	}
+	if (format == ENCODING_FORMAT_LEGACY) {
+		if (size < ENCODING_LEGACY_SIZE) {
+			return 0;
+		}
+		return encode_legacy(&samples[0], buf, len);
+	}
+	if (size < ENCODING_HEADER_SIZE + ENCODING_RECORD_SIZE) {
+		return 0;
+	}
+
+	if (format == ENCODING_FORMAT_DELTA) {
+		return encode_delta(samples, count, buf, size, len);
+	}
+	return encode_fixed(samples, count, buf, size, len);
+}
+
+/**
+ * @brief Decodes a frame in the delta format
+ * 
+ * @param buf Encoded frame, format byte included
+ * @param len Length of the frame
+ * @param samples Output array of samples
+ * @param max Maximum number of samples to decode, at least 1
+ * @return Number of samples decoded, or -EINVAL if the frame is malformed
+ */
+static int decode_delta(const uint8_t *buf, size_t len,
+			sensor_sample_t *samples, size_t max)
+{
+	size_t pos = ENCODING_HEADER_SIZE + ENCODING_RECORD_SIZE;
+	int32_t interval = 0;
+	size_t n;
+
+	if (len < pos) {
+		return -EINVAL;
+	}
+	get_record(&buf[ENCODING_HEADER_SIZE], &samples[0]);
+
+	for (n = 1; n < max && pos < len; n++) {
+		sensor_sample_t *cur = &samples[n];
+		uint32_t head;
+		uint32_t value;
+		int ret;
+
+		*cur = samples[n - 1];
+
+		ret = varint_get(&buf[pos], len - pos, &head);
+		if (ret < 0) {
+			return ret;
+		}
+		pos += ret;
+		cur->data.values[TEMPERATURE_CHANNEL] +=
+			zigzag_decode(head >> DELTA_FLAG_BITS);
+
+		if (head & DELTA_FLAG_INTERVAL) {
+			ret = varint_get(&buf[pos], len - pos, &value);
+			if (ret < 0) {
+				return ret;
+			}
+			pos += ret;
+			interval += zigzag_decode(value);
+		}
+		cur->timestamp += interval;
+
+		if (head & DELTA_FLAG_BATTERY) {
+			ret = varint_get(&buf[pos], len - pos, &value);
+			if (ret < 0) {
+				return ret;
+			}
+			pos += ret;
+			cur->data.values[BATTERY_CHANNEL] +=
+				zigzag_decode(value);
+		}
+	}
+	return n;
+}
+
+/**
+ * @brief Decodes a frame of any supported format
+ * 
+ * @param buf Encoded frame
+ * @param len Length of the frame
+ * @param samples Output array of samples
+ * @param max Maximum number of samples to decode
+ * @return Number of samples decoded, or -EINVAL if the frame is malformed
+ *         or uses an unknown format. A legacy frame decodes to one sample
+ *         with a 0 timestamp.
+ */
+int encoding_decode(const uint8_t *buf, size_t len, sensor_sample_t *samples,
+		    size_t max)
+{
+	if (len < ENCODING_HEADER_SIZE) {
+		return -EINVAL;
+	}
+	if (max == 0) {
+		return 0;
+	}
+
+	switch (buf[0]) {
+	case ENCODING_FORMAT_LEGACY:
+		if (len < ENCODING_LEGACY_SIZE) {
+			return -EINVAL;
+		}
+		samples[0].timestamp = 0;
+		samples[0].data.values[TEMPERATURE_CHANNEL] =
+			sys_get_be16(&buf[1]);
+		samples[0].data.values[BATTERY_CHANNEL] = sys_get_be16(&buf[3]);
+		return 1;
+	case ENCODING_FORMAT_FIXED: {
+		size_t records = (len - ENCODING_HEADER_SIZE) /
+				 ENCODING_RECORD_SIZE;
+		size_t n = MIN(records, max);
+
+		for (size_t i = 0; i < n; i++) {
+			get_record(&buf[ENCODING_HEADER_SIZE +
+					i * ENCODING_RECORD_SIZE],
+				   &samples[i]);
+		}
+		return n;
+	}
+	case ENCODING_FORMAT_DELTA:
+		return decode_delta(buf, len, samples, max);
+	default:
+		return -EINVAL;
+	}
+}
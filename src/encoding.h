@@ -0,0 +1,98 @@
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sensor.h"
+
+/**
+ * @brief Frame formats, stored in the first byte of every frame
+ * 
+ * Format 0 (legacy), the frame of the first firmware, after the format byte,
+ * a single sample without timestamp:
+ * - Bytes 0-1: Temperature in centi-degrees Celsius (big-endian int16)
+ * - Bytes 2-3: Battery voltage in mV (big-endian uint16)
+ * 
+ * Format 2 (fixed), after the format byte, for each sample an 8-byte record:
+ * - Bytes 0-3: Timestamp in seconds since boot (big-endian uint32)
+ * - Bytes 4-5: Temperature in centi-degrees Celsius (big-endian int16)
+ * - Bytes 6-7: Battery voltage in mV (big-endian uint16)
+ * 
+ * Format 1 (delta), after the format byte, the first sample as an 8-byte
+ * record laid out like format 2, then for each following sample:
+ * - A varint holding the zig-zag encoded temperature delta shifted left by
+ *   two bits, bit 0 flagging a timestamp change and bit 1 a battery change
+ * - If bit 0 is set, a varint holding the zig-zag encoded change of the
+ *   interval between samples (the interval before the first sample is 0)
+ * - If bit 1 is set, a varint holding the zig-zag encoded battery delta
+ * 
+ * Varints are little-endian base-128, with the high bit of each byte set
+ * when another byte follows. Deltas wrap around 16 bits, like the values.
+ * A batch sampled at a steady rate whose battery does not change packs to
+ * one byte per sample, as long as the temperature moves by at most 16 units
+ * between samples. Frames only carry the temperature and battery channels;
+ * additional probes are read on their GATT characteristics.
+ */
+typedef enum {
+	ENCODING_FORMAT_LEGACY = 0,
+	ENCODING_FORMAT_DELTA = 1,
+	ENCODING_FORMAT_FIXED = 2,
+} encoding_format_t;
+
+/* Size of the format byte starting every frame */
+#define ENCODING_HEADER_SIZE 1
+/* Size of a legacy frame, format byte included */
+#define ENCODING_LEGACY_SIZE 5
+/* Size of a sample encoded as a fixed record */
+#define ENCODING_RECORD_SIZE 8
+
+/* Size of a reading packed by encoding_put_reading() */
+#define ENCODING_READING_SIZE 7
+
+/**
+ * @brief Packs the latest reading for connectionless transfer
+ * 
+ * Used by the broadcast advertising data and the PAwR responses:
+ * - Byte 0: Format version (always 0)
+ * - Bytes 1-2: Rolling sequence counter (big-endian uint16)
+ * - Bytes 3-4: Temperature in centi-degrees Celsius (big-endian int16)
+ * - Bytes 5-6: Battery voltage in mV (big-endian uint16)
+ * 
+ * @param seq Rolling sequence counter of the reading
+ * @param data Latest sensor reading
+ * @param buf Output buffer of at least ENCODING_READING_SIZE bytes
+ */
+void encoding_put_reading(uint16_t seq, const sensor_data_t *data,
+			  uint8_t *buf);
+
+/**
+ * @brief Encodes as many samples as fit in a buffer
+ * 
+ * @param format Frame format to use
+ * @param samples Samples to encode, oldest first
+ * @param count Number of samples
+ * @param buf Output buffer
+ * @param size Size of the output buffer
+ * @param len Set to the number of bytes written
+ * @return Number of samples encoded, 0 if the buffer cannot hold one sample;
+ *         at most 1 in the legacy format
+ */
+size_t encoding_encode(encoding_format_t format,
+		       const sensor_sample_t *samples, size_t count,
+		       uint8_t *buf, size_t size, size_t *len);
+
+/**
+ * @brief Decodes a frame of any supported format
+ * 
+ * @param buf Encoded frame
+ * @param len Length of the frame
+ * @param samples Output array of samples
+ * @param max Maximum number of samples to decode
+ * @return Number of samples decoded, or -EINVAL if the frame is malformed
+ *         or uses an unknown format. A legacy frame decodes to one sample
+ *         with a 0 timestamp.
+ */
+int encoding_decode(const uint8_t *buf, size_t len, sensor_sample_t *samples,
+		    size_t max);
+
+#endif
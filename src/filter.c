@@ -0,0 +1,108 @@
+#include "filter.h"
+#include "channels.h"
+#include <stdbool.h>
+#include <zephyr/kernel.h>
+
+#define MEDIAN_SIZE (2 * CONFIG_LIONK_FILTER_MEDIAN_RADIUS + 1)
+#define EMA_SHIFT   CONFIG_LIONK_FILTER_EMA_SHIFT
+
+/* Fractional bits kept by the moving average between samples */
+#define EMA_FRACTION_BITS 8
+
+/* Filter state of a channel */
+typedef struct {
+	int32_t window[MEDIAN_SIZE]; // Last readings, oldest at next
+	size_t next;		     // Slot of the next reading in window
+	int32_t average;	     // Moving average, fixed point
+	bool primed;
+} filter_state_t;
+
+/* Only accessed from the system work queue */
+static filter_state_t filters[LIONK_CHANNEL_COUNT];
+
+/**
+ * @brief Returns the median of a channel's window
+ * 
+ * Sorts a copy of the window by insertion, which is the cheapest sort for
+ * the few readings of a spike rejector.
+ * 
+ * @param filter Filter state of the channel
+ * @return Median reading
+ */
+static int32_t window_median(const filter_state_t *filter)
+{
+	int32_t sorted[MEDIAN_SIZE];
+
+	for (size_t i = 0; i < MEDIAN_SIZE; i++) {
+		int32_t value = filter->window[i];
+		size_t j = i;
+
+		for (; j > 0 && sorted[j - 1] > value; j--) {
+			sorted[j] = sorted[j - 1];
+		}
+		sorted[j] = value;
+	}
+	return sorted[MEDIAN_SIZE / 2];
+}
+
+/**
+ * @brief Filters a new reading of a channel
+ * 
+ * Each channel has its own filter, made of two fixed-point stages:
+ * - A median of the last 2 * CONFIG_LIONK_FILTER_MEDIAN_RADIUS + 1
+ *   readings, which rejects isolated spikes such as the ones induced by
+ *   radio activity.
+ * - An exponential moving average of the medians, with a weight of
+ *   1 / 2^CONFIG_LIONK_FILTER_EMA_SHIFT for the new median. Its time
+ *   constant is about 2^CONFIG_LIONK_FILTER_EMA_SHIFT samples.
+ * 
+ * The first reading of a channel primes both stages, so the output starts
+ * at the first reading instead of ramping up from 0, as does the first
+ * reading after filter_reset(). A stage is bypassed when its radius or its
+ * shift is 0. Only filter channels sampled often: the filter delays a change
+ * by several samples, hours for the hourly battery readings. Called from
+ * the system work queue.
+ * 
+ * @param channel Index of the channel in the zephyr,user io-channels
+ * @param value_mv New millivolt reading of the channel
+ * @return Filtered millivolt value of the channel
+ */
+int32_t filter_update(size_t channel, int32_t value_mv)
+{
+	filter_state_t *filter = &filters[channel];
+
+	if (!filter->primed) {
+		for (size_t i = 0; i < MEDIAN_SIZE; i++) {
+			filter->window[i] = value_mv;
+		}
+		filter->average = value_mv << EMA_FRACTION_BITS;
+		filter->primed = true;
+		return value_mv;
+	}
+
+	filter->window[filter->next] = value_mv;
+	filter->next = (filter->next + 1) % MEDIAN_SIZE;
+
+	int32_t median = window_median(filter);
+
+	/* average += (median - average) / 2^shift, rounded to nearest */
+	filter->average += ((median << EMA_FRACTION_BITS) - filter->average +
+			    ((1 << EMA_SHIFT) >> 1)) >>
+			   EMA_SHIFT;
+	return (filter->average + (1 << (EMA_FRACTION_BITS - 1))) >>
+	       EMA_FRACTION_BITS;
+}
+
+/**
+ * @brief Restarts the filter of a channel
+ * 
+ * The next reading primes the filter again, so it goes through unchanged
+ * instead of being held back by the median and the moving average. Meant
+ * for a real step, which the filter would otherwise report late.
+ * 
+ * @param channel Index of the channel in the zephyr,user io-channels
+ */
+void filter_reset(size_t channel)
+{
+	filters[channel].primed = false;
+}
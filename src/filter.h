@@ -0,0 +1,42 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Filters a new reading of a channel
+ * 
+ * Each channel has its own filter, made of two fixed-point stages:
+ * - A median of the last 2 * CONFIG_LIONK_FILTER_MEDIAN_RADIUS + 1
+ *   readings, which rejects isolated spikes such as the ones induced by
+ *   radio activity.
+ * - An exponential moving average of the medians, with a weight of
+ *   1 / 2^CONFIG_LIONK_FILTER_EMA_SHIFT for the new median. Its time
+ *   constant is about 2^CONFIG_LIONK_FILTER_EMA_SHIFT samples.
+ * 
+ * The first reading of a channel primes both stages, so the output starts
+ * at the first reading instead of ramping up from 0, as does the first
+ * reading after filter_reset(). A stage is bypassed when its radius or its
+ * shift is 0. Only filter channels sampled often: the filter delays a change
+ * by several samples, hours for the hourly battery readings. Called from
+ * the system work queue.
+ * 
+ * @param channel Index of the channel in the zephyr,user io-channels
+ * @param value_mv New millivolt reading of the channel
+ * @return Filtered millivolt value of the channel
+ */
+int32_t filter_update(size_t channel, int32_t value_mv);
+
+/**
+ * @brief Restarts the filter of a channel
+ * 
+ * The next reading primes the filter again, so it goes through unchanged
+ * instead of being held back by the median and the moving average. Meant
+ * for a real step, which the filter would otherwise report late.
+ * 
+ * @param channel Index of the channel in the zephyr,user io-channels
+ */
+void filter_reset(size_t channel);
+
+#endif
@@ -0,0 +1,357 @@
+#include "history.h"
+#include "encoding.h"
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+
+LOG_MODULE_REGISTER(history, LOG_LEVEL_INF);
+
+#define HISTORY_SUBTREE	  "hist"
+#define HISTORY_KEY_LEN	  sizeof(HISTORY_SUBTREE "/65535")
+#define HISTORY_BOOT_NAME "boot"
+
+typedef struct {
+	uint32_t first_seq; // Sequence number of the first sample
+	uint16_t count; // Number of valid samples
+	uint16_t boot; // Boot counter when the samples were taken
+	sensor_sample_t samples[CONFIG_LIONK_HISTORY_BLOCK_SAMPLES];
+} history_block_t;
+
+/* A block is stored as its header followed by its samples encoded as a frame */
+#define BLOCK_HEADER_SIZE offsetof(history_block_t, samples)
+#define BLOCK_STORED_MAX                            \
+	(BLOCK_HEADER_SIZE + ENCODING_HEADER_SIZE + \
+	 CONFIG_LIONK_HISTORY_BLOCK_SAMPLES * ENCODING_RECORD_SIZE)
+
+/* Only accessed from the system work queue, or while settings are loaded */
+static history_block_t staging;
+static history_block_t loaded;
+static uint8_t stored[BLOCK_STORED_MAX];
+static uint32_t next_seq;
+static uint16_t boot;
+static bool log_found; // Not the first boot with this log
+
+/* Parameters of a direct load of one stored block */
+struct block_load {
+	history_block_t *block;
+	bool found;
+};
+
+/**
+ * @brief Returns the flash slot of the block starting at a sequence number
+ * 
+ * Only full blocks are written, so block boundaries are multiples of the
+ * block size and the slots are reused in a circular way.
+ * 
+ * @param first_seq Sequence number of the first sample of the block
+ * @return Slot index of the block
+ */
+static uint16_t block_slot(uint32_t first_seq)
+{
+	return (first_seq / CONFIG_LIONK_HISTORY_BLOCK_SAMPLES) %
+	       CONFIG_LIONK_HISTORY_BLOCKS;
+}
+
+/**
+ * @brief Writes the staged block to flash and starts a new one
+ * 
+ * The samples are delta-encoded, falling back to fixed records for the rare
+ * blocks that would be larger delta-encoded. On failure, the staged samples
+ * are kept so the write can be retried.
+ * 
+ * @return 0 on success, negative error code otherwise
+ */
+static int flush_staging(void)
+{
+	char key[HISTORY_KEY_LEN];
+	uint8_t *frame = &stored[BLOCK_HEADER_SIZE];
+	size_t frame_size = sizeof(stored) - BLOCK_HEADER_SIZE;
+	size_t len;
+
+	memcpy(stored, &staging, BLOCK_HEADER_SIZE);
+	if (encoding_encode(ENCODING_FORMAT_DELTA, staging.samples,
+			    staging.count, frame, frame_size,
+			    &len) < staging.count) {
+		encoding_encode(ENCODING_FORMAT_FIXED, staging.samples,
+				staging.count, frame, frame_size, &len);
+	}
+
+	snprintk(key, sizeof(key), HISTORY_SUBTREE "/%u",
+		 block_slot(staging.first_seq));
+	int err = settings_save_one(key, stored, BLOCK_HEADER_SIZE + len);
+	if (err) {
+		LOG_ERR("Couldn't write history block %u (%d)", staging.first_seq,
+			err);
+		return err;
+	}
+	LOG_INF("History block %u written", staging.first_seq);
+	staging.first_seq += staging.count;
+	staging.count = 0;
+	return 0;
+}
+
+/**
+ * @brief Appends a sample to the persistent history log
+ * 
+ * The sample is given the next sequence number and staged in RAM. Once
+ * CONFIG_LIONK_HISTORY_BLOCK_SAMPLES samples are staged, they are written to
+ * flash as a single block, overwriting the oldest block when the log is
+ * full. Staged samples that are not written yet are lost on reset.
+ * 
+ * @param sample Sample to store
+ * @return 0 on success, or negative error code if a block write failed. The
+ *         staged samples are kept and the write is retried on the next call,
+ *         but the sample is dropped if no staging room is left.
+ */
+int history_append(const sensor_sample_t *sample)
+{
+	if (staging.count == ARRAY_SIZE(staging.samples)) {
+		int err = flush_staging();
+		if (err) {
+			return err;
+		}
+	}
+
+	staging.samples[staging.count++] = *sample;
+	next_seq++;
+
+	if (staging.count == ARRAY_SIZE(staging.samples)) {
+		return flush_staging();
+	}
+	return 0;
+}
+
+/**
+ * @brief Returns the sequence number the next appended sample will get
+ * 
+ * Sequence numbers are contiguous and persist across resets, so a gap in
+ * the numbers received by a gateway means that samples were lost. Staged
+ * samples may already have been read when a reset loses them, so after a
+ * reset the numbering resumes one full block past the newest stored block,
+ * and the numbers of the lost samples are never given to new ones.
+ * 
+ * @return Next sequence number
+ */
+uint32_t history_next_seq(void)
+{
+	return next_seq;
+}
+
+/**
+ * @brief Returns the boot counter of the device
+ * 
+ * The counter is persisted with the log and incremented on every boot.
+ * Sample timestamps are seconds since boot, so the boot counter places
+ * logged samples in time across resets. Blocks written before the counter
+ * existed read as boot 0.
+ * 
+ * @return Boot counter of the current boot
+ */
+uint16_t history_boot_count(void)
+{
+	return boot;
+}
+
+/**
+ * @brief Reads and decodes a stored block found by a direct settings load
+ * 
+ * @param key Remainder of the key after the requested name (unused)
+ * @param len Length of the stored block
+ * @param read_cb Function reading the stored value
+ * @param cb_arg Argument of read_cb
+ * @param param Block load parameters
+ * @return 0
+ */
+static int load_block_cb(const char *key, size_t len, settings_read_cb read_cb,
+			 void *cb_arg, void *param)
+{
+	struct block_load *load = param;
+
+	if (len <= BLOCK_HEADER_SIZE || len > sizeof(stored) ||
+	    read_cb(cb_arg, stored, len) != len) {
+		return 0;
+	}
+
+	memcpy(load->block, stored, BLOCK_HEADER_SIZE);
+	int count = encoding_decode(&stored[BLOCK_HEADER_SIZE],
+				    len - BLOCK_HEADER_SIZE,
+				    load->block->samples,
+				    ARRAY_SIZE(load->block->samples));
+	load->found = count == load->block->count;
+	return 0;
+}
+
+/**
+ * @brief Loads the flash block starting at a sequence number
+ * 
+ * @param first_seq Sequence number of the first sample of the block
+ * @return true if the block is stored and still holds those samples
+ */
+static bool load_block(uint32_t first_seq)
+{
+	char key[HISTORY_KEY_LEN];
+	struct block_load load = {
+		.block = &loaded,
+	};
+
+	snprintk(key, sizeof(key), HISTORY_SUBTREE "/%u",
+		 block_slot(first_seq));
+	int err = settings_load_subtree_direct(key, load_block_cb, &load);
+	if (err || !load.found) {
+		return false;
+	}
+	return loaded.first_seq == first_seq &&
+	       loaded.count == ARRAY_SIZE(loaded.samples);
+}
+
+/**
+ * @brief Copies the samples of a block starting at a sequence number
+ * 
+ * @param block Block holding seq
+ * @param seq Sequence number of the first sample to copy
+ * @param samples Output array of samples
+ * @param max Maximum number of samples to copy
+ * @param first_seq Set to seq
+ * @param boot_count Set to the boot counter of the block
+ * @return Number of samples copied
+ */
+static size_t copy_samples(const history_block_t *block, uint32_t seq,
+			   sensor_sample_t *samples, size_t max,
+			   uint32_t *first_seq, uint16_t *boot_count)
+{
+	size_t offset = seq - block->first_seq;
+	size_t n = MIN(max, block->count - offset);
+
+	memcpy(samples, &block->samples[offset], n * sizeof(*samples));
+	*first_seq = seq;
+	*boot_count = block->boot;
+	return n;
+}
+
+/**
+ * @brief Reads logged samples starting at a sequence number
+ * 
+ * Samples are read from the flash blocks and from the staged RAM block. If
+ * the requested sample is no longer stored, reading starts at the oldest
+ * stored sample after it, which the caller detects through first_seq. A
+ * single call never returns samples from more than one block, so all the
+ * samples read were taken during the same boot; their timestamps are
+ * seconds since that boot.
+ * 
+ * @param seq Sequence number of the first requested sample
+ * @param samples Output array of samples
+ * @param max Maximum number of samples to read
+ * @param first_seq Set to the sequence number of samples[0], or to
+ *                  history_next_seq() if no sample is left
+ * @param boot_count Set to the boot counter of the samples, see
+ *                   history_boot_count()
+ * @return Number of samples read, 0 once seq reached history_next_seq()
+ */
+size_t history_read(uint32_t seq, sensor_sample_t *samples, size_t max,
+		    uint32_t *first_seq, uint16_t *boot_count)
+{
+	const uint32_t block_size = ARRAY_SIZE(staging.samples);
+	const uint32_t capacity = block_size * CONFIG_LIONK_HISTORY_BLOCKS;
+
+	/* Older blocks have been overwritten by the circular log */
+	if (staging.first_seq > capacity &&
+	    seq < staging.first_seq - capacity) {
+		seq = staging.first_seq - capacity;
+	}
+
+	while (seq < staging.first_seq) {
+		uint32_t block_start = seq - seq % block_size;
+
+		if (load_block(block_start)) {
+			return copy_samples(&loaded, seq, samples, max,
+					    first_seq, boot_count);
+		}
+		/* Block lost (write failure or older layout), skip it */
+		seq = block_start + block_size;
+	}
+
+	if (seq < next_seq) {
+		return copy_samples(&staging, seq, samples, max, first_seq,
+				    boot_count);
+	}
+	*first_seq = next_seq;
+	*boot_count = boot;
+	return 0;
+}
+
+/**
+ * @brief Settings handler called for every stored history block
+ * 
+ * Only the block header is read, to find the newest block and resume the
+ * sequence numbering after it. The boot counter is stored along the blocks.
+ * 
+ * @param name Key of the block, relative to the history subtree
+ * @param len Length of the stored block
+ * @param read_cb Function reading the stored value
+ * @param cb_arg Argument of read_cb
+ * @return 0 on success, negative error code otherwise
+ */
+static int history_set(const char *name, size_t len, settings_read_cb read_cb,
+		       void *cb_arg)
+{
+	history_block_t *block = &staging;
+
+	if (settings_name_steq(name, HISTORY_BOOT_NAME, NULL)) {
+		if (len != sizeof(boot) ||
+		    read_cb(cb_arg, &boot, sizeof(boot)) != sizeof(boot)) {
+			LOG_WRN("Ignoring invalid boot counter");
+			return 0;
+		}
+		log_found = true;
+		return 0;
+	}
+
+	if (len <= BLOCK_HEADER_SIZE || len > sizeof(stored)) {
+		LOG_WRN("Ignoring history block %s with unexpected size", name);
+		return 0;
+	}
+
+	ssize_t ret = read_cb(cb_arg, block, BLOCK_HEADER_SIZE);
+	if (ret < 0) {
+		return ret;
+	}
+
+	log_found = true;
+
+	uint32_t end_seq = block->first_seq + block->count;
+	if (end_seq > next_seq) {
+		next_seq = end_seq;
+	}
+	return 0;
+}
+
+/**
+ * @brief Settings handler called once all history blocks are loaded
+ * 
+ * Counts the boot, then resets the staging block. Unless the log is new,
+ * the staging block starts one block past the newest stored block: the
+ * samples staged before the reset used those numbers and are lost.
+ * 
+ * @return 0
+ */
+static int history_commit(void)
+{
+	if (log_found) {
+		next_seq += ARRAY_SIZE(staging.samples);
+		boot++;
+	}
+
+	int err = settings_save_one(HISTORY_SUBTREE "/" HISTORY_BOOT_NAME,
+				    &boot, sizeof(boot));
+	if (err) {
+		LOG_ERR("Couldn't save boot counter (%d)", err);
+	}
+	memset(&staging, 0, sizeof(staging));
+	staging.first_seq = next_seq;
+	staging.boot = boot;
+	LOG_INF("History resumes at sequence %u, boot %u", next_seq, boot);
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(history, HISTORY_SUBTREE, NULL, history_set,
+			       history_commit, NULL);
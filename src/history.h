@@ -0,0 +1,70 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sensor.h"
+
+/**
+ * @brief Appends a sample to the persistent history log
+ * 
+ * The sample is given the next sequence number and staged in RAM. Once
+ * CONFIG_LIONK_HISTORY_BLOCK_SAMPLES samples are staged, they are written to
+ * flash as a single block, overwriting the oldest block when the log is
+ * full. Staged samples that are not written yet are lost on reset.
+ * 
+ * @param sample Sample to store
+ * @return 0 on success, or negative error code if a block write failed. The
+ *         staged samples are kept and the write is retried on the next call,
+ *         but the sample is dropped if no staging room is left.
+ */
+int history_append(const sensor_sample_t *sample);
+
+/**
+ * @brief Returns the sequence number the next appended sample will get
+ * 
+ * Sequence numbers are contiguous and persist across resets, so a gap in
+ * the numbers received by a gateway means that samples were lost. Staged
+ * samples may already have been read when a reset loses them, so after a
+ * reset the numbering resumes one full block past the newest stored block,
+ * and the numbers of the lost samples are never given to new ones.
+ * 
+ * @return Next sequence number
+ */
+uint32_t history_next_seq(void);
+
+/**
+ * @brief Returns the boot counter of the device
+ * 
+ * The counter is persisted with the log and incremented on every boot.
+ * Sample timestamps are seconds since boot, so the boot counter places
+ * logged samples in time across resets. Blocks written before the counter
+ * existed read as boot 0.
+ * 
+ * @return Boot counter of the current boot
+ */
+uint16_t history_boot_count(void);
+
+/**
+ * @brief Reads logged samples starting at a sequence number
+ * 
+ * Samples are read from the flash blocks and from the staged RAM block. If
+ * the requested sample is no longer stored, reading starts at the oldest
+ * stored sample after it, which the caller detects through first_seq. A
+ * single call never returns samples from more than one block, so all the
+ * samples read were taken during the same boot; their timestamps are
+ * seconds since that boot.
+ * 
+ * @param seq Sequence number of the first requested sample
+ * @param samples Output array of samples
+ * @param max Maximum number of samples to read
+ * @param first_seq Set to the sequence number of samples[0], or to
+ *                  history_next_seq() if no sample is left
+ * @param boot_count Set to the boot counter of the samples, see
+ *                   history_boot_count()
+ * @return Number of samples read, 0 once seq reached history_next_seq()
+ */
+size_t history_read(uint32_t seq, sensor_sample_t *samples, size_t max,
+		    uint32_t *first_seq, uint16_t *boot_count);
+
+#endif
@@ -0,0 +1,421 @@
+#include "ble.h"
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/bluetooth/hci_vs.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/buf.h>
+#include <zephyr/sys/byteorder.h>
+
+LOG_MODULE_REGISTER(link, LOG_LEVEL_INF);
+
+/*
+ * Link adaptation.
+ * 
+ * Every CONFIG_LIONK_LINK_PERIOD seconds, the RSSI of each connection is
+ * read and smoothed. The link margin is the smoothed RSSI above the
+ * sensitivity of the current PHY, less the transmit power reduction, since
+ * the central hears the device that much weaker than the device hears it.
+ * The link then steps along a ladder of PHY and transmit power levels, one
+ * level per period:
+ * - toward a cheaper level while that level would keep at least
+ *   CONFIG_LIONK_LINK_MARGIN + CONFIG_LIONK_LINK_HYSTERESIS dB of margin
+ * - toward a more robust level once the margin falls below
+ *   CONFIG_LIONK_LINK_MARGIN dB
+ * 
+ * A PHY the central refused is not requested again on that connection, so
+ * the link stops stepping at the last level it can reach.
+ * 
+ * The link status characteristic returns, for the reading central:
+ * - Byte 0: TX PHY (1: 1M, 2: 2M, 4: Coded)
+ * - Byte 1: Transmit power in dBm (int8)
+ * - Byte 2: Smoothed RSSI in dBm (int8)
+ * - Byte 3: Link margin in dB (int8)
+ */
+
+#define LINK_STATUS_SIZE 4
+
+/* Weight of a new RSSI reading is 1/2^RSSI_SHIFT */
+#define RSSI_SHIFT	 2
+/* Fractional bits of the smoothed RSSI */
+#define RSSI_FRACTION	 4
+/* Reported by the controller when no RSSI is available */
+#define RSSI_UNAVAILABLE 127
+
+#define NO_LEVEL	 UINT8_MAX
+
+typedef struct {
+	uint8_t phy;
+	int8_t tx_power; // dBm
+	int8_t sensitivity; // dBm, of the receiver on this PHY
+} link_level_t;
+
+/* From the cheapest to the most robust */
+static const link_level_t levels[] = {
+	{ BT_GAP_LE_PHY_2M, -20, -92 },
+	{ BT_GAP_LE_PHY_2M, -12, -92 },
+	{ BT_GAP_LE_PHY_2M, -4, -92 },
+	{ BT_GAP_LE_PHY_2M, 0, -92 },
+	{ BT_GAP_LE_PHY_1M, 0, -95 },
+	{ BT_GAP_LE_PHY_CODED, 0, -103 },
+	{ BT_GAP_LE_PHY_CODED, 8, -103 },
+};
+
+/* State of a connection, indexed by bt_conn_index() */
+typedef struct {
+	uint8_t level;
+	uint8_t pending; // Level waiting for a PHY update, or NO_LEVEL
+	uint8_t phy; // Current TX PHY
+	uint8_t refused_phys; // PHYs the central refused, BT_GAP_LE_PHY_* bits
+	int8_t tx_power; // Current transmit power in dBm
+	bool rssi_valid;
+	int16_t rssi; // Smoothed RSSI in dBm, RSSI_FRACTION fractional bits
+} link_t;
+
+static ssize_t read_status(struct bt_conn *conn,
+			   const struct bt_gatt_attr *attr, void *buf,
+			   uint16_t len, uint16_t offset);
+static void adapt_links(struct k_work *work);
+
+BT_GATT_SERVICE_DEFINE(link_svc, BT_GATT_PRIMARY_SERVICE(BT_UUID_LINK_SVC),
+		       BT_GATT_CHARACTERISTIC(BT_UUID_LINK_STATUS,
+					      BT_GATT_CHRC_READ,
+					      BT_GATT_PERM_READ, read_status,
+					      NULL, NULL));
+
+K_WORK_DELAYABLE_DEFINE(adapt_work, adapt_links);
+
+static link_t links[CONFIG_BT_MAX_CONN];
+
+/**
+ * @brief Computes the margin of a link at a level
+ * 
+ * @param link Link state, with a valid RSSI
+ * @param level Index of the level in levels
+ * @return Link margin in dB
+ */
+static int margin_at(const link_t *link, size_t level)
+{
+	int rssi = link->rssi / (1 << RSSI_FRACTION);
+
+	return rssi + MIN(levels[level].tx_power, 0) -
+	       levels[level].sensitivity;
+}
+
+/**
+ * @brief Tells if a level can be requested on a connection
+ * 
+ * @param link Link state
+ * @param level Index of the level in levels
+ * @return true unless the central refused the PHY of the level
+ */
+static bool level_allowed(const link_t *link, size_t level)
+{
+	return !(link->refused_phys & levels[level].phy);
+}
+
+/**
+ * @brief Finds the level matching the current PHY and transmit power
+ * 
+ * @param link Link state
+ * @return Index of the most robust level using the current PHY, at the
+ *         current transmit power when one does
+ */
+static uint8_t current_level(const link_t *link)
+{
+	uint8_t found = NO_LEVEL;
+
+	for (size_t i = 0; i < ARRAY_SIZE(levels); i++) {
+		if (levels[i].phy != link->phy) {
+			continue;
+		}
+		if (found == NO_LEVEL ||
+		    levels[found].tx_power != link->tx_power) {
+			found = i;
+		}
+	}
+	return found == NO_LEVEL ? link->level : found;
+}
+
+/**
+ * @brief Reads the RSSI of a connection
+ * 
+ * @param conn BLE connection handle
+ * @param rssi Set to the RSSI in dBm
+ * @return 0 on success, negative error code otherwise
+ */
+static int read_rssi(struct bt_conn *conn, int8_t *rssi)
+{
+	struct bt_hci_cp_read_rssi *cp;
+	struct net_buf *buf;
+	struct net_buf *rsp = NULL;
+	uint16_t handle;
+
+	int err = bt_hci_get_conn_handle(conn, &handle);
+	if (err) {
+		return err;
+	}
+
+	buf = bt_hci_cmd_create(BT_HCI_OP_READ_RSSI, sizeof(*cp));
+	if (!buf) {
+		return -ENOBUFS;
+	}
+	cp = net_buf_add(buf, sizeof(*cp));
+	cp->handle = sys_cpu_to_le16(handle);
+
+	err = bt_hci_cmd_send_sync(BT_HCI_OP_READ_RSSI, buf, &rsp);
+	if (err) {
+		return err;
+	}
+	*rssi = ((struct bt_hci_rp_read_rssi *)rsp->data)->rssi;
+	net_buf_unref(rsp);
+	return 0;
+}
+
+/**
+ * @brief Sets the transmit power of a connection
+ * 
+ * @param conn BLE connection handle
+ * @param link Link state, updated on success
+ * @param dbm Transmit power in dBm
+ * @return 0 on success, negative error code otherwise
+ */
+static int set_tx_power(struct bt_conn *conn, link_t *link, int8_t dbm)
+{
+	struct bt_hci_cp_vs_write_tx_power_level *cp;
+	struct net_buf *buf;
+	struct net_buf *rsp = NULL;
+	uint16_t handle;
+
+	int err = bt_hci_get_conn_handle(conn, &handle);
+	if (err) {
+		return err;
+	}
+
+	buf = bt_hci_cmd_create(BT_HCI_OP_VS_WRITE_TX_POWER_LEVEL,
+				sizeof(*cp));
+	if (!buf) {
+		return -ENOBUFS;
+	}
+	cp = net_buf_add(buf, sizeof(*cp));
+	cp->handle = sys_cpu_to_le16(handle);
+	cp->handle_type = BT_HCI_VS_LL_HANDLE_TYPE_CONN;
+	cp->tx_power_level = dbm;
+
+	err = bt_hci_cmd_send_sync(BT_HCI_OP_VS_WRITE_TX_POWER_LEVEL, buf,
+				   &rsp);
+	if (err) {
+		return err;
+	}
+	link->tx_power = dbm;
+	net_buf_unref(rsp);
+	return 0;
+}
+
+/**
+ * @brief Moves a connection to a level
+ * 
+ * The transmit power changes right away. A PHY change is requested, and
+ * the level is only reached once the PHY update completes.
+ * 
+ * @param conn BLE connection handle
+ * @param link Link state
+ * @param level Index of the level in levels
+ */
+static void apply_level(struct bt_conn *conn, link_t *link, uint8_t level)
+{
+	if (levels[level].phy != link->phy) {
+		const struct bt_conn_le_phy_param param = {
+			.options = levels[level].phy == BT_GAP_LE_PHY_CODED ?
+					   BT_CONN_LE_PHY_OPT_CODED_S8 :
+					   BT_CONN_LE_PHY_OPT_NONE,
+			.pref_tx_phy = levels[level].phy,
+			.pref_rx_phy = levels[level].phy,
+		};
+
+		int err = bt_conn_le_phy_update(conn, &param);
+		if (err) {
+			LOG_ERR("Couldn't request PHY %u (%d)",
+				levels[level].phy, err);
+			return;
+		}
+		link->pending = level;
+		return;
+	}
+
+	link->level = level;
+	if (link->tx_power != levels[level].tx_power) {
+		int err = set_tx_power(conn, link, levels[level].tx_power);
+		if (err) {
+			LOG_ERR("Couldn't set transmit power (%d)", err);
+		}
+	}
+}
+
+/**
+ * @brief Adapts the PHY and transmit power of a connection
+ * 
+ * @param conn BLE connection handle
+ * @param data Number of connected links, incremented
+ */
+static void adapt_link(struct bt_conn *conn, void *data)
+{
+	size_t *active = data;
+	link_t *link = &links[bt_conn_index(conn)];
+	struct bt_conn_info info;
+	int8_t rssi;
+
+	if (bt_conn_get_info(conn, &info) ||
+	    info.state != BT_CONN_STATE_CONNECTED) {
+		return;
+	}
+	(*active)++;
+	if (link->pending != NO_LEVEL) {
+		/* Waiting for the PHY update */
+		return;
+	}
+	if (link->tx_power != levels[link->level].tx_power) {
+		/* The PHY of the level was reached since the last period */
+		apply_level(conn, link, link->level);
+	}
+
+	int err = read_rssi(conn, &rssi);
+	if (err || rssi == RSSI_UNAVAILABLE) {
+		return;
+	}
+
+	int16_t sample = rssi * (1 << RSSI_FRACTION);
+	if (!link->rssi_valid) {
+		link->rssi = sample;
+		link->rssi_valid = true;
+	} else {
+		link->rssi += (sample - link->rssi) / (1 << RSSI_SHIFT);
+	}
+
+	uint8_t level = link->level;
+	int margin = margin_at(link, level);
+
+	if (level > 0 && level_allowed(link, level - 1) &&
+	    margin_at(link, level - 1) >=
+		    CONFIG_LIONK_LINK_MARGIN + CONFIG_LIONK_LINK_HYSTERESIS) {
+		level--;
+	} else if (level < ARRAY_SIZE(levels) - 1 &&
+		   level_allowed(link, level + 1) &&
+		   margin < CONFIG_LIONK_LINK_MARGIN) {
+		level++;
+	} else {
+		return;
+	}
+
+	LOG_INF("Link margin %d dB, moving to PHY %u at %d dBm", margin,
+		levels[level].phy, levels[level].tx_power);
+	apply_level(conn, link, level);
+}
+
+/**
+ * @brief Adapts every connection, once per period
+ * 
+ * Runs on the system work queue while a central is connected.
+ * 
+ * @param work Pointer to the work structure (unused)
+ */
+static void adapt_links(struct k_work *work)
+{
+	size_t active = 0;
+
+	(void)work;
+	bt_conn_foreach(BT_CONN_TYPE_LE, adapt_link, &active);
+	if (active > 0) {
+		k_work_schedule(&adapt_work,
+				K_SECONDS(CONFIG_LIONK_LINK_PERIOD));
+	}
+}
+
+/**
+ * @brief Reads the link status of the reading central
+ * 
+ * @param conn BLE connection handle
+ * @param attr GATT attribute being read
+ * @param buf Buffer to store the read data
+ * @param len Maximum length of data to read
+ * @param offset Offset within the attribute value
+ * @return Number of bytes read, or negative error code on failure
+ */
+static ssize_t read_status(struct bt_conn *conn,
+			   const struct bt_gatt_attr *attr, void *buf,
+			   uint16_t len, uint16_t offset)
+{
+	const link_t *link = &links[bt_conn_index(conn)];
+	uint8_t value[LINK_STATUS_SIZE];
+
+	value[0] = link->phy;
+	value[1] = link->tx_power;
+	value[2] = link->rssi / (1 << RSSI_FRACTION);
+	value[3] = link->rssi_valid ? margin_at(link, link->level) : 0;
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, value,
+				 sizeof(value));
+}
+
+/**
+ * @brief Callback function called when a BLE connection is established
+ * 
+ * The connection starts on 1M PHY at 0 dBm, and the adaptation runs once
+ * the first period elapsed.
+ * 
+ * @param conn BLE connection handle
+ * @param err Error code (0 if connection successful)
+ */
+static void link_connected(struct bt_conn *conn, uint8_t err)
+{
+	link_t *link = &links[bt_conn_index(conn)];
+
+	if (err) {
+		return;
+	}
+
+	*link = (link_t){
+		.phy = BT_GAP_LE_PHY_1M,
+		.pending = NO_LEVEL,
+	};
+	link->level = current_level(link);
+	k_work_schedule(&adapt_work, K_SECONDS(CONFIG_LIONK_LINK_PERIOD));
+}
+
+/**
+ * @brief Callback function called when BLE PHY update procedure completes
+ * 
+ * Completes a pending level. A pending level whose PHY was not reached was
+ * refused by the central: its PHY is not requested again on this
+ * connection. A PHY change the adaptation did not ask for, such as the
+ * Coded PHY requested on connection, moves the link to the level of the
+ * new PHY.
+ * 
+ * @param conn BLE connection handle
+ * @param param Structure containing the new PHY information
+ */
+static void link_phy_updated(struct bt_conn *conn,
+			     struct bt_conn_le_phy_info *param)
+{
+	link_t *link = &links[bt_conn_index(conn)];
+
+	link->phy = param->tx_phy;
+	link->refused_phys &= ~link->phy;
+	if (link->pending != NO_LEVEL &&
+	    levels[link->pending].phy == link->phy) {
+		link->level = link->pending;
+	} else {
+		if (link->pending != NO_LEVEL) {
+			LOG_WRN("Central refused PHY %u",
+				levels[link->pending].phy);
+			link->refused_phys |= levels[link->pending].phy;
+		}
+		link->level = current_level(link);
+	}
+	link->pending = NO_LEVEL;
+}
+
+BT_CONN_CB_DEFINE(link_callbacks) = {
+	.connected = link_connected,
+	.le_phy_updated = link_phy_updated,
+};
@@ -1,8 +1,43 @@
 #include "lionk_adc.h"
+#include "channels.h"
 #include <zephyr/logging/log.h>
 
 LOG_MODULE_REGISTER(lionk_adc, LOG_LEVEL_INF);
 
+#define LIONK_ADC_SPEC(node_id, prop, idx) ADC_DT_SPEC_GET_BY_IDX(node_id, idx),
+
+static const struct adc_dt_spec channels[] = { DT_FOREACH_PROP_ELEM(
+	LIONK_CHANNELS_NODE, io_channels, LIONK_ADC_SPEC) };
+
+/* State of the asynchronous read, which must outlive the call starting it */
+static int16_t async_buf[ARRAY_SIZE(channels)];
+static struct adc_sequence async_sequence;
+static struct adc_sequence_options burst_options;
+static uint32_t async_mask;
+
+/**
+ * @brief Convert a raw ADC sample to millivolts
+ * 
+ * The SAADC stores signed 16-bit samples for both differential and
+ * single-ended channels: a single-ended input near 0 V can read slightly
+ * negative, so the sample is always sign-extended. If the conversion is not
+ * supported, the raw value is returned.
+ * 
+ * @param spec Pointer to ADC device tree specification of the sampled channel
+ * @param raw Raw sample as stored by the ADC driver
+ * @return int Voltage in millivolts
+ */
+static int raw_to_millivolts(const struct adc_dt_spec *spec, int16_t raw)
+{
+	int val_mv = raw;
+	int err = adc_raw_to_millivolts_dt(spec, &val_mv);
+	/* conversion to mV may not be supported, skip if not */
+	if (err < 0) {
+		LOG_INF("Can't Get value in mV\n");
+	}
+	return val_mv;
+}
+
 /**
  * @brief Set up an ADC channel for reading
  * 
@@ -34,8 +69,7 @@ void lionk_adc_setup(const struct adc_dt_spec *spec)
  */
 int lionk_adc_do_read(const struct adc_dt_spec *spec)
 {
-	uint16_t buf;
-	int val_mv;
+	int16_t buf;
 	struct adc_sequence sequence = {
 		.buffer = &buf,
 		/* buffer size in bytes, not number of samples */
@@ -54,15 +88,257 @@ int lionk_adc_do_read(const struct adc_dt_spec *spec)
 		return 0;
 	}
 
-	if (spec->channel_cfg.differential) {
-		val_mv = (int32_t)((int16_t)buf);
-	} else {
-		val_mv = (int32_t)buf;
+	return raw_to_millivolts(spec, buf);
+}
+
+/**
+ * @brief Set up every ADC channel listed in the zephyr,user node
+ * 
+ * Configures all io-channels of the zephyr,user node so they can be read
+ * together with lionk_adc_read_channels(). All channels must belong to the
+ * same ADC device. If setup fails, the function will assert and halt
+ * execution.
+ */
+void lionk_adc_setup_all(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(channels); i++) {
+		__ASSERT(channels[i].dev == channels[0].dev,
+			 "All zephyr,user io-channels must use the same ADC");
+		__ASSERT(adc_is_ready_dt(&channels[i]), "ADC %s is not ready",
+			 channels[i].dev->name);
+		lionk_adc_setup(&channels[i]);
 	}
-	err = adc_raw_to_millivolts_dt(spec, &val_mv);
-	/* conversion to mV may not be supported, skip if not */
+}
+
+/**
+ * @brief Select the channels of a mask in an ADC sequence
+ * 
+ * Sets the hardware channel bits and the resolution of the sequence for
+ * every zephyr,user io-channel selected in the mask.
+ * 
+ * @param sequence ADC sequence to fill
+ * @param mask Bit mask of channels, bit n selecting the n-th io-channel
+ * @return 0 on success, -EINVAL if the mask selects no channel
+ */
+static int select_channels(struct adc_sequence *sequence, uint32_t mask)
+{
+	mask &= BIT_MASK(ARRAY_SIZE(channels));
+	if (mask == 0) {
+		return -EINVAL;
+	}
+
+	sequence->channels = 0;
+	for (size_t i = 0; i < ARRAY_SIZE(channels); i++) {
+		if (mask & BIT(i)) {
+			sequence->channels |= BIT(channels[i].channel_id);
+			sequence->resolution = channels[i].resolution;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Convert the samples of a completed sequence to millivolts
+ * 
+ * The driver stores one sample per channel, in ascending channel id order,
+ * whatever the order of the io-channels property.
+ * 
+ * @param sequence Completed ADC sequence
+ * @param mask Bit mask of channels the sequence was built from
+ * @param buf Sample buffer of the sequence
+ * @param values_mv Output array indexed like the zephyr,user io-channels
+ */
+static void convert_samples(const struct adc_sequence *sequence, uint32_t mask,
+			    const int16_t *buf, int32_t *values_mv)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(channels); i++) {
+		if (!(mask & BIT(i))) {
+			continue;
+		}
+		uint8_t slot = __builtin_popcount(
+			sequence->channels & BIT_MASK(channels[i].channel_id));
+		values_mv[i] = raw_to_millivolts(&channels[i], buf[slot]);
+	}
+}
+
+/**
+ * @brief Read several ADC channels and convert to millivolts
+ * 
+ * Without oversampling, builds one ADC sequence covering every channel
+ * selected in the mask, so the SAADC is started once and scans all channels
+ * back to back. The SAADC can only oversample a single channel, so with
+ * oversampling each selected channel is read by its own sequence, averaged
+ * in hardware over 2^oversampling conversions. Entries of values_mv for
+ * channels not selected in the mask are left untouched.
+ * 
+ * @param mask Bit mask of channels to read, bit n selecting the n-th
+ *             zephyr,user io-channel
+ * @param oversampling Hardware oversampling factor as a power of two
+ * @param values_mv Output array of LIONK_CHANNEL_COUNT millivolt values,
+ *                  indexed like the zephyr,user io-channels
+ * @return 0 on success, -EINVAL if the mask selects no channel, or other
+ *         negative error code if the read failed
+ */
+int lionk_adc_read_channels(uint32_t mask, uint8_t oversampling,
+			    int32_t *values_mv)
+{
+	int16_t buf[ARRAY_SIZE(channels)];
+	struct adc_sequence sequence = {
+		.buffer = buf,
+		.buffer_size = sizeof(buf),
+		.oversampling = oversampling,
+	};
+
+	mask &= BIT_MASK(ARRAY_SIZE(channels));
+	if (oversampling > 0 && __builtin_popcount(mask) > 1) {
+		/* The driver refuses to oversample several channels */
+		for (size_t i = 0; i < ARRAY_SIZE(channels); i++) {
+			if (mask & BIT(i)) {
+				int err = lionk_adc_read_channels(
+					BIT(i), oversampling, values_mv);
+				if (err < 0) {
+					return err;
+				}
+			}
+		}
+		return 0;
+	}
+
+	int err = select_channels(&sequence, mask);
 	if (err < 0) {
-		LOG_INF("Can't Get value in mV\n");
+		return err;
 	}
-	return val_mv;
+
+	err = adc_read(channels[0].dev, &sequence);
+	if (err < 0) {
+		LOG_WRN("Couldn't read from ADC %s (%d)", channels[0].dev->name,
+			err);
+		return err;
+	}
+
+	convert_samples(&sequence, mask, buf, values_mv);
+	return 0;
+}
+
+/**
+ * @brief Start reading several ADC channels in a single scan without blocking
+ * 
+ * Same as lionk_adc_read_channels(), but returns as soon as the conversion
+ * is started. The signal is raised when the scan completes, and the values
+ * are then fetched with lionk_adc_read_channels_result(). Only one
+ * asynchronous read can be in progress at a time. The SAADC cannot
+ * oversample a scan, so with oversampling the mask must select a single
+ * channel.
+ * 
+ * @param mask Bit mask of channels to read, bit n selecting the n-th
+ *             zephyr,user io-channel
+ * @param oversampling Hardware oversampling factor as a power of two
+ * @param signal Poll signal raised with the read result on completion
+ * @return 0 if the read was started, -EINVAL if the mask selects no channel
+ *         or several channels with oversampling, or other negative error
+ *         code
+ */
+int lionk_adc_read_channels_async(uint32_t mask, uint8_t oversampling,
+				  struct k_poll_signal *signal)
+{
+	async_sequence.options = NULL;
+	async_sequence.buffer = async_buf;
+	async_sequence.buffer_size = sizeof(async_buf);
+	async_sequence.oversampling = oversampling;
+
+	int err = select_channels(&async_sequence, mask);
+	if (err < 0) {
+		return err;
+	}
+	if (oversampling > 0 &&
+	    __builtin_popcount(async_sequence.channels) > 1) {
+		/* The driver refuses to oversample several channels */
+		return -EINVAL;
+	}
+	async_mask = mask;
+
+	err = adc_read_async(channels[0].dev, &async_sequence, signal);
+	if (err < 0) {
+		LOG_WRN("Couldn't start read from ADC %s (%d)",
+			channels[0].dev->name, err);
+	}
+	return err;
+}
+
+/**
+ * @brief Convert the samples of the last asynchronous read to millivolts
+ * 
+ * Must only be called once the signal passed to
+ * lionk_adc_read_channels_async() has been raised. Entries of values_mv for
+ * channels not selected in the mask are left untouched.
+ * 
+ * @param values_mv Output array of LIONK_CHANNEL_COUNT millivolt values,
+ *                  indexed like the zephyr,user io-channels
+ */
+void lionk_adc_read_channels_result(int32_t *values_mv)
+{
+	convert_samples(&async_sequence, async_mask, async_buf, values_mv);
+}
+
+/**
+ * @brief Start sampling one channel at a fixed interval without blocking
+ * 
+ * Builds a single ADC sequence taking count samples of the channel, one
+ * every interval_us, stored one after the other in buf. The progress
+ * callback is invoked by the driver after each sample, so the captured
+ * part of the buffer can be used while the rest is being sampled. The
+ * signal is raised when the last sample is stored. Shares its state with
+ * lionk_adc_read_channels_async(): only one of them can be in progress.
+ * 
+ * @param channel Index of the channel in the zephyr,user io-channels
+ * @param interval_us Interval between two samples in microseconds
+ * @param buf Output array of count raw samples
+ * @param count Number of samples, from 1 to 65536
+ * @param progress Callback invoked after each sample, may be NULL
+ * @param signal Poll signal raised with the read result on completion
+ * @return 0 if the read was started, -EINVAL if the channel or the count is
+ *         out of range, or other negative error code
+ */
+int lionk_adc_read_burst_async(size_t channel, uint32_t interval_us,
+			       int16_t *buf, size_t count,
+			       adc_sequence_callback progress,
+			       struct k_poll_signal *signal)
+{
+	if (channel >= ARRAY_SIZE(channels) || count == 0 ||
+	    count > UINT16_MAX + 1) {
+		return -EINVAL;
+	}
+
+	/* The driver moves along the buffer for each extra sampling */
+	burst_options.interval_us = interval_us;
+	burst_options.callback = progress;
+	burst_options.user_data = NULL;
+	burst_options.extra_samplings = count - 1;
+
+	async_sequence.options = &burst_options;
+	async_sequence.buffer = buf;
+	async_sequence.buffer_size = count * sizeof(*buf);
+	async_sequence.oversampling = 0;
+	async_sequence.calibrate = false;
+	select_channels(&async_sequence, BIT(channel));
+	async_mask = 0;
+
+	int err = adc_read_async(channels[0].dev, &async_sequence, signal);
+	if (err < 0) {
+		LOG_WRN("Couldn't start burst on ADC %s (%d)",
+			channels[0].dev->name, err);
+	}
+	return err;
+}
+
+/**
+ * @brief Convert a raw sample of a channel to millivolts
+ * 
+ * @param channel Index of the channel in the zephyr,user io-channels
+ * @param raw Raw sample as stored by lionk_adc_read_burst_async()
+ * @return Voltage in millivolts
+ */
+int32_t lionk_adc_to_millivolts(size_t channel, int16_t raw)
+{
+	return raw_to_millivolts(&channels[channel], raw);
 }
@@ -26,4 +26,101 @@ void lionk_adc_setup(const struct adc_dt_spec *spec);
  */
 int lionk_adc_do_read(const struct adc_dt_spec *spec);
 
+/**
+ * @brief Set up every ADC channel listed in the zephyr,user node
+ * 
+ * Configures all io-channels of the zephyr,user node so they can be read
+ * together with lionk_adc_read_channels(). All channels must belong to the
+ * same ADC device. If setup fails, the function will assert and halt
+ * execution.
+ */
+void lionk_adc_setup_all(void);
+
+/**
+ * @brief Read several ADC channels and convert to millivolts
+ * 
+ * Without oversampling, builds one ADC sequence covering every channel
+ * selected in the mask, so the SAADC is started once and scans all channels
+ * back to back. The SAADC can only oversample a single channel, so with
+ * oversampling each selected channel is read by its own sequence, averaged
+ * in hardware over 2^oversampling conversions. Entries of values_mv for
+ * channels not selected in the mask are left untouched.
+ * 
+ * @param mask Bit mask of channels to read, bit n selecting the n-th
+ *             zephyr,user io-channel
+ * @param oversampling Hardware oversampling factor as a power of two
+ * @param values_mv Output array of LIONK_CHANNEL_COUNT millivolt values,
+ *                  indexed like the zephyr,user io-channels
+ * @return 0 on success, -EINVAL if the mask selects no channel, or other
+ *         negative error code if the read failed
+ */
+int lionk_adc_read_channels(uint32_t mask, uint8_t oversampling,
+			    int32_t *values_mv);
+
+/**
+ * @brief Start reading several ADC channels in a single scan without blocking
+ * 
+ * Same as lionk_adc_read_channels(), but returns as soon as the conversion
+ * is started. The signal is raised when the scan completes, and the values
+ * are then fetched with lionk_adc_read_channels_result(). Only one
+ * asynchronous read can be in progress at a time. The SAADC cannot
+ * oversample a scan, so with oversampling the mask must select a single
+ * channel.
+ * 
+ * @param mask Bit mask of channels to read, bit n selecting the n-th
+ *             zephyr,user io-channel
+ * @param oversampling Hardware oversampling factor as a power of two
+ * @param signal Poll signal raised with the read result on completion
+ * @return 0 if the read was started, -EINVAL if the mask selects no channel
+ *         or several channels with oversampling, or other negative error
+ *         code
+ */
+int lionk_adc_read_channels_async(uint32_t mask, uint8_t oversampling,
+				  struct k_poll_signal *signal);
+
+/**
+ * @brief Convert the samples of the last asynchronous read to millivolts
+ * 
+ * Must only be called once the signal passed to
+ * lionk_adc_read_channels_async() has been raised. Entries of values_mv for
+ * channels not selected in the mask are left untouched.
+ * 
+ * @param values_mv Output array of LIONK_CHANNEL_COUNT millivolt values,
+ *                  indexed like the zephyr,user io-channels
+ */
+void lionk_adc_read_channels_result(int32_t *values_mv);
+
+/**
+ * @brief Start sampling one channel at a fixed interval without blocking
+ * 
+ * Builds a single ADC sequence taking count samples of the channel, one
+ * every interval_us, stored one after the other in buf. The progress
+ * callback is invoked by the driver after each sample, so the captured
+ * part of the buffer can be used while the rest is being sampled. The
+ * signal is raised when the last sample is stored. Shares its state with
+ * lionk_adc_read_channels_async(): only one of them can be in progress.
+ * 
+ * @param channel Index of the channel in the zephyr,user io-channels
+ * @param interval_us Interval between two samples in microseconds
+ * @param buf Output array of count raw samples
+ * @param count Number of samples, from 1 to 65536
+ * @param progress Callback invoked after each sample, may be NULL
+ * @param signal Poll signal raised with the read result on completion
+ * @return 0 if the read was started, -EINVAL if the channel or the count is
+ *         out of range, or other negative error code
+ */
+int lionk_adc_read_burst_async(size_t channel, uint32_t interval_us,
+			       int16_t *buf, size_t count,
+			       adc_sequence_callback progress,
+			       struct k_poll_signal *signal);
+
+/**
+ * @brief Convert a raw sample of a channel to millivolts
+ * 
+ * @param channel Index of the channel in the zephyr,user io-channels
+ * @param raw Raw sample as stored by lionk_adc_read_burst_async()
+ * @return Voltage in millivolts
+ */
+int32_t lionk_adc_to_millivolts(size_t channel, int16_t raw);
+
 #endif
@@ -1,115 +1,209 @@
-#include "lionk_adc.h"
+#include "adaptive.h"
+#include "bulk.h"
+#include "filter.h"
+#include "history.h"
+#include "pawr.h"
+#include "predictor.h"
+#include "sample_buffer.h"
+#include "sampler.h"
 #include "sensor.h"
+#include "stats.h"
+#include "temperature.h"
 #include <stdint.h>
+#include <stdlib.h>
 #include <zephyr/kernel.h>
-#include <zephyr/drivers/gpio.h>
 #include <zephyr/logging/log.h>
-#include <zephyr/drivers/adc.h>
 
 #include "ble.h"
 
 LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
 
-static void do_work(struct k_work *work);
-static void timer_handler(struct k_timer *timer);
-static void update_data(void);
+static void do_work(int err, size_t channel, int32_t value_mv);
+static void update_data(size_t channel, int32_t value_mv);
+static void set_sampling_period(uint16_t seconds);
+static void set_temperature_period(uint32_t seconds);
 
-K_WORK_DEFINE(update_data_work, do_work);
-K_TIMER_DEFINE(work_timer, timer_handler, NULL);
-
-sensor_data_t sensor_data;
-static sensor_state_t state = DISCONNECTED;
-
-static const struct gpio_dt_spec temp_resistor_div_en =
-	GPIO_DT_SPEC_GET(DT_ALIAS(resistordiven0), gpios);
-static const struct gpio_dt_spec battery_resistor_div_en =
-	GPIO_DT_SPEC_GET(DT_ALIAS(resistordiven1), gpios);
-
-static const struct adc_dt_spec temperature_spec =
-	ADC_DT_SPEC_GET_BY_IDX(DT_PATH(zephyr_user), 0);
-
-static const struct adc_dt_spec battery_spec =
-	ADC_DT_SPEC_GET_BY_IDX(DT_PATH(zephyr_user), 1);
+/* Working values, only accessed from the system work queue */
+static sensor_data_t sensor_data;
 
 /**
- * @brief Updates sensor data by reading temperature and battery values
+ * @brief Updates sensor data from a channel reading
+ * 
+ * This function converts the millivolt value of a completed sampling cycle
+ * to meaningful units: the temperature channel goes through the calibrated
+ * lookup table of temperature_convert(), the other channels through the
+ * coefficients of their devicetree properties. The last battery reading is
+ * the supply of a thermistor divider, both being powered from VDD.
  * 
- * This function enables the resistor dividers, waits for voltage stabilization,
- * reads ADC values for temperature and battery, then disables the resistor
- * dividers to save power. The raw ADC values are converted to meaningful units.
+ * @param channel Index of the channel in the zephyr,user io-channels
+ * @param value_mv Millivolt value of the channel
  */
-void update_data(void)
+void update_data(size_t channel, int32_t value_mv)
 {
-	gpio_pin_set_dt(&temp_resistor_div_en, 1);
-	gpio_pin_set_dt(&battery_resistor_div_en, 0);
+	if (channel == TEMPERATURE_CHANNEL) {
+		sensor_data.values[channel] = temperature_convert(
+			value_mv, sensor_data.values[BATTERY_CHANNEL]);
+	} else {
+		sensor_data.values[channel] =
+			lionk_channel_convert(channel, value_mv);
+	}
+}
 
-	k_msleep(10);
+/**
+ * @brief Restarts the temperature filter once a step has persisted
+ * 
+ * The moving average would hold a real step back for several samples, and
+ * the adaptive sampling and the predictor would see it late. A reading
+ * further than the adaptive threshold from the filtered temperature only
+ * counts as a step once more than CONFIG_LIONK_FILTER_MEDIAN_RADIUS
+ * consecutive readings moved the same way, which the median already lets
+ * through; the filter then restarts at the new reading. Isolated spikes
+ * never restart it.
+ * 
+ * @param value_mv Unfiltered millivolt value of the temperature channel
+ */
+static void restart_filter_on_step(int32_t value_mv)
+{
+	static uint8_t step_readings;
+	static bool step_up;
+	adaptive_bounds_t bounds;
+	int32_t delta = temperature_convert(
+				value_mv, sensor_data.values[BATTERY_CHANNEL]) -
+			(int16_t)sensor_data.values[TEMPERATURE_CHANNEL];
 
-	uint16_t temp_read_mv = lionk_adc_do_read(&temperature_spec);
-	uint16_t battery_read = lionk_adc_do_read(&battery_spec);
+	adaptive_get_bounds(&bounds);
+	if (abs(delta) <= bounds.threshold) {
+		step_readings = 0;
+		return;
+	}
+	if (step_readings == 0 || step_up != (delta > 0)) {
+		step_readings = 0;
+		step_up = delta > 0;
+	}
+	if (++step_readings > CONFIG_LIONK_FILTER_MEDIAN_RADIUS) {
+		filter_reset(TEMPERATURE_CHANNEL);
+		step_readings = 0;
+	}
+}
 
-	gpio_pin_set_dt(&temp_resistor_div_en, 0);
-	gpio_pin_set_dt(&battery_resistor_div_en, 1);
+/**
+ * @brief Moves the samples waiting for a notification to the history log
+ * 
+ * Called while no central is subscribed, so samples that cannot be delivered
+ * are persisted instead of being overwritten in the RAM buffer.
+ */
+static void archive_samples(void)
+{
+	sensor_sample_t sample;
 
-	sensor_data.temperature = temp_read_mv - 500;
-	sensor_data.battery_mv = battery_read * 4;
+	while (sample_buffer_peek(&sample, 1) == 1) {
+		if (history_append(&sample)) {
+			break;
+		}
+		sample_buffer_drop(1);
+	}
 }
 
 /**
- * @brief Main work function that handles sensor updates and BLE state management
+ * @brief Main work function that handles sensor updates
  * 
- * This function is called periodically by the timer. It updates sensor data,
- * logs the values, and manages the BLE connection state machine (disconnected,
- * advertising, connected). When connected and subscribed, it sends sensor data.
+ * This function is called by the sampler on the system work queue each time
+ * a channel has been sampled. Readings of the other channels only refresh
+ * the values sent with the next temperature sample. Each temperature sample
+ * completes a sample set, published for the other threads with
+ * sensor_publish() and added to the rolling statistics, and logs the
+ * values. Every sample is timestamped and
+ * buffered, unless predictive reporting is enabled and the gateway can
+ * predict it; when centrals are subscribed, the samples are sent to each at
+ * its own pace, see ble_send_data(); otherwise the samples are moved to the
+ * persistent history log. The connections themselves are managed by the
+ * Bluetooth events, see ble_update_state(). Temperature readings are
+ * filtered before conversion, see filter.h; a lasting step restarts the
+ * filter. The other channels are sampled too rarely to filter: the battery,
+ * read hourly, would lag by hours, and it is the thermistor supply.
+ * On a sampling error the previous values are kept and nothing is buffered.
  * 
- * @param work Pointer to the work structure (unused)
+ * @param err 0 on success, negative error code if sampling failed
+ * @param channel Index of the sampled channel in the zephyr,user io-channels
+ * @param value_mv Millivolt value of the channel, meaningless on failure
  */
-void do_work(struct k_work *work)
+void do_work(int err, size_t channel, int32_t value_mv)
 {
-	(void)work;
-	update_data();
-	LOG_INF("Temperature: %d, battery %d", sensor_data.temperature,
-		sensor_data.battery_mv);
-	switch (state) {
-	case DISCONNECTED:
-		ble_start_advertising();
-		state = ADVERTISING;
-		LOG_INF("Advertising");
-		break;
-
-	case ADVERTISING:
-		if (ble_is_connected()) {
-			state = CONNECTED;
-			LOG_INF("Connected!");
+	uint32_t now = k_uptime_get() / MSEC_PER_SEC;
+
+	if (err) {
+		LOG_ERR("Couldn't read sensor channel %zu (%d)", channel, err);
+	} else {
+		if (channel == TEMPERATURE_CHANNEL) {
+			restart_filter_on_step(value_mv);
+			value_mv = filter_update(channel, value_mv);
 		}
-		break;
-	case CONNECTED:
-		if (!ble_is_connected()) {
-			LOG_INF("Disconnected");
-			state = DISCONNECTED;
+		update_data(channel, value_mv);
+	}
+	if (channel != TEMPERATURE_CHANNEL) {
+		return;
+	}
+
+	if (!err) {
+		const sensor_sample_t sample = {
+			.timestamp = now,
+			.data = sensor_data,
+		};
+		sensor_publish(&sensor_data, now);
+		stats_update(&sample);
+		if (!IS_ENABLED(CONFIG_LIONK_PREDICTIVE_REPORTING) ||
+		    predictor_update(&sample)) {
+			sample_buffer_put(&sample);
 		}
 
-		if (ble_is_subscribed()) {
-			const int ret = ble_send_data();
-			if (ret) {
-				LOG_ERR("Couldn't send data (%d)", ret);
-			}
+		const int ret = ble_broadcast_update();
+		if (ret) {
+			LOG_ERR("Couldn't update broadcast data (%d)", ret);
+		}
+		adaptive_update(
+			(int16_t)sensor_data.values[TEMPERATURE_CHANNEL]);
+	}
+	LOG_INF("Temperature: %d, battery %d",
+		(int16_t)sensor_data.values[TEMPERATURE_CHANNEL],
+		sensor_data.values[BATTERY_CHANNEL]);
+
+	if (!ble_is_subscribed()) {
+		archive_samples();
+	} else {
+		const int ret = ble_send_data(now);
+		if (ret) {
+			LOG_ERR("Couldn't send data (%d)", ret);
 		}
-		break;
 	}
 }
 
 /**
- * @brief Timer callback function that submits work to the system work queue
+ * @brief Fixes the sampling period while a gateway collects over PAwR
  * 
- * This function is called every second by the timer and submits the sensor
- * update work to be processed by the system work queue.
+ * Called when a gateway pushes a new sampling period over PAwR, and with 0
+ * when the synchronization is lost. The period is a runtime override of
+ * the adaptive period: it is not saved, so the persisted bounds apply again
+ * once the gateway is gone. Gateways repeat the command in every subevent;
+ * the adaptive module ignores the repetitions.
  * 
- * @param timer Pointer to the timer structure (unused)
+ * @param seconds New sampling period in seconds, 0 to adapt again
  */
-void timer_handler(struct k_timer *timer)
+void set_sampling_period(uint16_t seconds)
 {
-	k_work_submit(&update_data_work);
+	adaptive_set_override(seconds);
+}
+
+/**
+ * @brief Changes the sampling period of the temperature channel
+ * 
+ * Called when the adaptive sampling period changes. The next temperature
+ * sample is taken one period from now.
+ * 
+ * @param seconds New sampling period in seconds
+ */
+void set_temperature_period(uint32_t seconds)
+{
+	sampler_set_period(TEMPERATURE_CHANNEL, seconds * MSEC_PER_SEC);
 }
 
 /**
@@ -163,10 +257,11 @@ static void nrf_bootloader_debug_port_disable(void)
  * 
  * This function initializes the system by:
  * - Configuring flash protection settings
- * - Setting up GPIO pins for resistor divider control
- * - Initializing BLE functionality
- * - Configuring ADC channels for temperature and battery monitoring
- * - Starting a periodic timer for sensor updates
+ * - Setting up the sampling pipeline (resistor divider GPIOs and ADC)
+ * - Initializing BLE functionality, the bulk history download server and
+ *   the PAwR collection mode
+ * - Starting the per-channel sampling scheduler; the temperature period
+ *   adapts to its rate of change, the battery is sampled far less often
  * - Entering an infinite sleep state (work is handled by interrupts)
  * 
  * @return Should never return; exits with error code if initialization fails
@@ -177,36 +272,16 @@ int main(void)
 
 	nrf_bootloader_debug_port_disable();
 
-	if (!gpio_is_ready_dt(&temp_resistor_div_en)) {
-		LOG_ERR("GPIO device %s is not ready",
-			temp_resistor_div_en.port->name);
-		return -1;
-	}
-	if (!gpio_is_ready_dt(&battery_resistor_div_en)) {
-		LOG_ERR("GPIO device %s is not ready",
-			battery_resistor_div_en.port->name);
-		return -1;
-	}
-
-	ret = gpio_pin_configure_dt(&temp_resistor_div_en,
-				    GPIO_OUTPUT_INACTIVE);
+	ret = sampler_init(do_work);
 	if (ret < 0) {
-		LOG_ERR("Cannot configure GPIO pin for temperature resistor divider");
+		LOG_ERR("Cannot initialize sampling (%d)", ret);
 		return -1;
 	}
 
-	ret = gpio_pin_configure_dt(&battery_resistor_div_en,
-				    GPIO_OUTPUT_INACTIVE);
-	if (ret < 0) {
-		LOG_ERR("Cannot configure GPIO pin for battery resistor divider");
-		return -1;
-	}
-
-	LOG_INF("GPIO pins configured for resistor divider control");
-
 	ble_setup();
-	lionk_adc_setup(&temperature_spec);
-	lionk_adc_setup(&battery_spec);
-	k_timer_start(&work_timer, K_SECONDS(1), K_SECONDS(1));
+	bulk_init();
+	pawr_init(set_sampling_period);
+	set_temperature_period(adaptive_init(set_temperature_period));
+	sampler_start();
 	k_sleep(K_FOREVER);
 }
@@ -0,0 +1,250 @@
+#include "pawr.h"
+#include "ble.h"
+#include "encoding.h"
+#include "sensor.h"
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/buf.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+
+LOG_MODULE_REGISTER(pawr, LOG_LEVEL_INF);
+
+/* Size of a command in the subevent data sent by the gateway */
+#define PAWR_COMMAND_SIZE 4
+
+/* Periodic advertising events skipped between two receptions */
+#define PAWR_SYNC_SKIP	  1
+/* Sync timeout in units of 10 ms */
+#define PAWR_SYNC_TIMEOUT 1000
+
+typedef struct {
+	uint8_t subevent;
+	uint8_t response_slot;
+} __packed pawr_timing_t;
+
+static ssize_t write_timing(struct bt_conn *conn,
+			    const struct bt_gatt_attr *attr, const void *buf,
+			    uint16_t len, uint16_t offset, uint8_t flags);
+
+BT_GATT_SERVICE_DEFINE(pawr_svc, BT_GATT_PRIMARY_SERVICE(BT_UUID_PAWR_SVC),
+		       BT_GATT_CHARACTERISTIC(BT_UUID_PAWR_TIMING,
+					      BT_GATT_CHRC_WRITE,
+					      BT_GATT_PERM_WRITE, NULL,
+					      write_timing, NULL));
+
+NET_BUF_SIMPLE_DEFINE_STATIC(response_buf, ENCODING_READING_SIZE);
+
+static pawr_period_cb_t period_cb;
+static pawr_timing_t timing;
+static atomic_t synced;
+
+/**
+ * @brief Stores the subevent and response slot assigned by the gateway
+ * 
+ * The timing applies to the next synchronization transferred by the gateway.
+ * 
+ * @param conn BLE connection handle
+ * @param attr GATT attribute being written
+ * @param buf Written value, the subevent then the response slot
+ * @param len Length of the written value
+ * @param offset Write offset
+ * @param flags Write flags
+ * @return Number of bytes written, or a negative ATT error code
+ */
+static ssize_t write_timing(struct bt_conn *conn,
+			    const struct bt_gatt_attr *attr, const void *buf,
+			    uint16_t len, uint16_t offset, uint8_t flags)
+{
+	if (offset) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+	if (len != sizeof(timing)) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	memcpy(&timing, buf, sizeof(timing));
+	LOG_INF("Assigned subevent %u, response slot %u", timing.subevent,
+		timing.response_slot);
+	return len;
+}
+
+/**
+ * @brief Applies the commands addressed to this device in a request
+ * 
+ * @param buf Subevent data sent by the gateway
+ */
+static void handle_commands(const struct net_buf_simple *buf)
+{
+	for (size_t i = 0; i + PAWR_COMMAND_SIZE <= buf->len;
+	     i += PAWR_COMMAND_SIZE) {
+		const uint8_t *command = &buf->data[i];
+		uint16_t value = sys_get_be16(&command[2]);
+
+		if (command[0] != timing.response_slot) {
+			continue;
+		}
+		switch (command[1]) {
+		case PAWR_CMD_SET_PERIOD:
+			if (value && period_cb) {
+				period_cb(value);
+			}
+			break;
+		default:
+			LOG_WRN("Unknown PAwR command 0x%02x", command[1]);
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Callback function called when synchronized to a PAwR train
+ * 
+ * Restricts the reception to the subevent assigned to this device.
+ * 
+ * @param sync Periodic advertising sync
+ * @param info Synchronization information
+ */
+static void synced_cb(struct bt_le_per_adv_sync *sync,
+		      struct bt_le_per_adv_sync_synced_info *info)
+{
+	struct bt_le_per_adv_sync_subevent_params params = {
+		.properties = 0,
+		.num_subevents = 1,
+		.subevents = &timing.subevent,
+	};
+
+	int err = bt_le_per_adv_sync_subevent(sync, &params);
+	if (err) {
+		LOG_ERR("Couldn't select subevent %u (%d)", timing.subevent,
+			err);
+	}
+
+	atomic_set(&synced, 1);
+	ble_update_state();
+	LOG_INF("Synchronized to gateway, interval %u ms",
+		info->interval * 5 / 4);
+}
+
+/**
+ * @brief Callback function called when the PAwR synchronization is lost
+ * 
+ * The device advertises again right away, so the gateway can transfer a
+ * new synchronization, and drops the sampling period the gateway pushed.
+ * 
+ * @param sync Periodic advertising sync
+ * @param info Termination information
+ */
+static void term_cb(struct bt_le_per_adv_sync *sync,
+		    const struct bt_le_per_adv_sync_term_info *info)
+{
+	atomic_set(&synced, 0);
+	ble_update_state();
+	LOG_INF("Synchronization lost (reason %u)", info->reason);
+	if (period_cb) {
+		period_cb(0);
+	}
+}
+
+/**
+ * @brief Callback function called when a request is received
+ * 
+ * Applies the commands of the request, then answers it in the assigned
+ * response slot with the latest reading, taken from a consistent copy of
+ * the latest sample set. The reading sequence number is the one of the set.
+ * 
+ * @param sync Periodic advertising sync
+ * @param info Reception information
+ * @param buf Subevent data, NULL if the reception failed
+ */
+static void recv_cb(struct bt_le_per_adv_sync *sync,
+		    const struct bt_le_per_adv_sync_recv_info *info,
+		    struct net_buf_simple *buf)
+{
+	if (!buf) {
+		return;
+	}
+
+	handle_commands(buf);
+
+	struct bt_le_per_adv_response_params params = {
+		.request_event = info->periodic_event_counter,
+		.request_subevent = info->subevent,
+		.response_subevent = info->subevent,
+		.response_slot = timing.response_slot,
+	};
+
+	sensor_snapshot_t snapshot;
+
+	sensor_read(&snapshot);
+	net_buf_simple_reset(&response_buf);
+	encoding_put_reading(snapshot.seq, &snapshot.data,
+			     net_buf_simple_add(&response_buf,
+						ENCODING_READING_SIZE));
+
+	int err = bt_le_per_adv_set_response_data(sync, &params,
+						  &response_buf);
+	if (err) {
+		LOG_ERR("Couldn't set response data (%d)", err);
+	}
+}
+
+static struct bt_le_per_adv_sync_cb sync_callbacks = {
+	.synced = synced_cb,
+	.term = term_cb,
+	.recv = recv_cb,
+};
+
+/**
+ * @brief Prepares the device to be collected over PAwR by a gateway
+ * 
+ * A gateway connects, writes the PAwR timing characteristic with the
+ * subevent and the response slot assigned to this device (one byte each),
+ * then transfers its periodic advertising with responses train with PAST
+ * and disconnects. Once synchronized, the device listens to its subevent
+ * only and answers every request in its response slot with the reading
+ * packed by encoding_put_reading().
+ * 
+ * The subevent data sent by the gateway is a list of 4-byte commands:
+ * - Byte 0: Response slot the command is addressed to
+ * - Byte 1: Command (PAWR_CMD_SET_PERIOD)
+ * - Bytes 2-3: Command value (big-endian uint16)
+ * 
+ * This must be called after the Bluetooth stack is enabled.
+ * 
+ * @param cb Callback applying the sampling period pushed by the gateway
+ * @return 0 on success, negative error code on failure
+ */
+int pawr_init(pawr_period_cb_t cb)
+{
+	const struct bt_le_per_adv_sync_transfer_param param = {
+		.skip = PAWR_SYNC_SKIP,
+		.timeout = PAWR_SYNC_TIMEOUT,
+		.options = BT_LE_PER_ADV_SYNC_TRANSFER_OPT_NONE,
+	};
+
+	period_cb = cb;
+	bt_le_per_adv_sync_cb_register(&sync_callbacks);
+
+	int err = bt_le_per_adv_sync_transfer_subscribe(NULL, &param);
+	if (err) {
+		LOG_ERR("Couldn't subscribe to sync transfers (%d)", err);
+	}
+	return err;
+}
+
+/**
+ * @brief Checks if the device is synchronized to a gateway's PAwR train
+ * 
+ * While synchronized, readings are collected by the gateway, so the device
+ * does not need to advertise.
+ * 
+ * @return true if synchronized, false otherwise
+ */
+bool pawr_is_synced(void)
+{
+	return atomic_get(&synced);
+}
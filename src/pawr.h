@@ -0,0 +1,69 @@
+#ifndef PAWR_H
+#define PAWR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Command sent by the gateway to set the sampling period in seconds */
+#define PAWR_CMD_SET_PERIOD 0x01
+
+/**
+ * @brief Callback applying a sampling period pushed by the gateway
+ * 
+ * Called from the Bluetooth receive thread. The period only holds while
+ * synchronized: the callback is invoked with 0 once the synchronization is
+ * lost.
+ * 
+ * @param seconds New sampling period in seconds, 0 to drop it
+ */
+typedef void (*pawr_period_cb_t)(uint16_t seconds);
+
+#if defined(CONFIG_LIONK_PAWR)
+
+/**
+ * @brief Prepares the device to be collected over PAwR by a gateway
+ * 
+ * A gateway connects, writes the PAwR timing characteristic with the
+ * subevent and the response slot assigned to this device (one byte each),
+ * then transfers its periodic advertising with responses train with PAST
+ * and disconnects. Once synchronized, the device listens to its subevent
+ * only and answers every request in its response slot with the reading
+ * packed by encoding_put_reading().
+ * 
+ * The subevent data sent by the gateway is a list of 4-byte commands:
+ * - Byte 0: Response slot the command is addressed to
+ * - Byte 1: Command (PAWR_CMD_SET_PERIOD)
+ * - Bytes 2-3: Command value (big-endian uint16)
+ * 
+ * This must be called after the Bluetooth stack is enabled.
+ * 
+ * @param cb Callback applying the sampling period pushed by the gateway
+ * @return 0 on success, negative error code on failure
+ */
+int pawr_init(pawr_period_cb_t cb);
+
+/**
+ * @brief Checks if the device is synchronized to a gateway's PAwR train
+ * 
+ * While synchronized, readings are collected by the gateway, so the device
+ * does not need to advertise.
+ * 
+ * @return true if synchronized, false otherwise
+ */
+bool pawr_is_synced(void);
+
+#else
+
+static inline int pawr_init(pawr_period_cb_t cb)
+{
+	return 0;
+}
+
+static inline bool pawr_is_synced(void)
+{
+	return false;
+}
+
+#endif
+
+#endif
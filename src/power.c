@@ -0,0 +1,212 @@
+#include "power.h"
+#include "ble.h"
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/device.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/pm/device_runtime.h>
+#include <zephyr/sys/byteorder.h>
+
+LOG_MODULE_REGISTER(power, LOG_LEVEL_INF);
+
+/* Bytes per device in the power statistics characteristic */
+#define POWER_STATS_SIZE 8
+
+/* Runtime power management state of a sampling device */
+typedef struct {
+	const struct device *dev;
+	uint32_t resumes;
+	uint64_t active_ms;
+	int64_t resumed_at_ms; // Uptime of the last resume, if active
+	bool active;
+} power_device_t;
+
+static ssize_t read_stats(struct bt_conn *conn,
+			  const struct bt_gatt_attr *attr, void *buf,
+			  uint16_t len, uint16_t offset);
+
+BT_GATT_SERVICE_DEFINE(power_svc, BT_GATT_PRIMARY_SERVICE(BT_UUID_POWER_SVC),
+		       BT_GATT_CHARACTERISTIC(BT_UUID_POWER_STATS,
+					      BT_GATT_CHRC_READ,
+					      BT_GATT_PERM_READ, read_stats,
+					      NULL, NULL));
+
+/* Statistics are read from any thread */
+static struct k_spinlock lock;
+static power_device_t devices[POWER_DEVICE_MAX];
+static size_t device_count;
+
+/**
+ * @brief Adds a device to the sampling devices
+ * 
+ * Devices shared by several channels are only added once. Runtime power
+ * management is enabled on the device, which suspends it. A device without
+ * power management support is added as always on.
+ * 
+ * @param dev Device to add
+ * @return 0 on success, negative error code if power management could not
+ *         be enabled
+ */
+static int add_device(const struct device *dev)
+{
+	for (size_t i = 0; i < device_count; i++) {
+		if (devices[i].dev == dev) {
+			return 0;
+		}
+	}
+
+	int err = pm_device_runtime_enable(dev);
+	if (err == -ENOTSUP) {
+		LOG_WRN("%s has no power management, keeping it on",
+			dev->name);
+	} else if (err) {
+		LOG_ERR("Couldn't enable power management of %s (%d)",
+			dev->name, err);
+		return err;
+	}
+	devices[device_count++].dev = dev;
+	return 0;
+}
+
+/**
+ * @brief Enables runtime power management of the sampling devices
+ * 
+ * The sampling devices are the ADC and the GPIO ports of the resistor
+ * divider enable pins. They are suspended until power_resume() is called.
+ * A device without power management support stays always on, but its
+ * active time is still accounted. Must be called once the ADC channels
+ * and the GPIO pins are configured.
+ * 
+ * @return 0 on success, negative error code on failure
+ */
+int power_init(void)
+{
+	int err = add_device(DEVICE_DT_GET(
+		DT_IO_CHANNELS_CTLR_BY_IDX(LIONK_CHANNELS_NODE, 0)));
+
+	for (size_t i = 0; !err && i < LIONK_CHANNEL_COUNT; i++) {
+		err = add_device(lionk_channels[i].divider_en.port);
+	}
+	return err;
+}
+
+/**
+ * @brief Resumes the sampling devices for a sampling cycle
+ * 
+ * Called from the system work queue, and balanced by power_suspend(), even
+ * when a device failed to resume: the devices that did resume are then
+ * suspended again.
+ * 
+ * @return 0 on success, negative error code if a device failed to resume
+ */
+int power_resume(void)
+{
+	int ret = 0;
+
+	for (size_t i = 0; i < device_count; i++) {
+		int err = pm_device_runtime_get(devices[i].dev);
+		if (err) {
+			LOG_ERR("Couldn't resume %s (%d)", devices[i].dev->name,
+				err);
+			ret = err;
+			continue;
+		}
+
+		K_SPINLOCK(&lock) {
+			devices[i].resumes++;
+			devices[i].resumed_at_ms = k_uptime_get();
+			devices[i].active = true;
+		}
+	}
+	return ret;
+}
+
+/**
+ * @brief Suspends the sampling devices at the end of a sampling cycle
+ * 
+ * Called from the system work queue.
+ */
+void power_suspend(void)
+{
+	for (size_t i = 0; i < device_count; i++) {
+		if (!devices[i].active) {
+			continue;
+		}
+
+		K_SPINLOCK(&lock) {
+			devices[i].active_ms +=
+				k_uptime_get() - devices[i].resumed_at_ms;
+			devices[i].active = false;
+		}
+
+		int err = pm_device_runtime_put(devices[i].dev);
+		if (err) {
+			LOG_ERR("Couldn't suspend %s (%d)",
+				devices[i].dev->name, err);
+		}
+	}
+}
+
+/**
+ * @brief Returns the activity of the sampling devices
+ * 
+ * The ADC comes first, then the GPIO ports in the order of the channels
+ * they first appear in. This function can be called from any thread.
+ * 
+ * @param stats Filled with the activity of each device
+ * @param max Capacity of stats
+ * @return Number of devices filled
+ */
+size_t power_get_stats(power_stats_t *stats, size_t max)
+{
+	size_t count = MIN(device_count, max);
+
+	K_SPINLOCK(&lock) {
+		int64_t now = k_uptime_get();
+
+		for (size_t i = 0; i < count; i++) {
+			const power_device_t *device = &devices[i];
+
+			stats[i].name = device->dev->name;
+			stats[i].resumes = device->resumes;
+			stats[i].active_ms = device->active_ms;
+			if (device->active) {
+				stats[i].active_ms +=
+					now - device->resumed_at_ms;
+			}
+		}
+	}
+	return count;
+}
+
+/**
+ * @brief Reads the power statistics characteristic
+ * 
+ * For each sampling device, in the order of power_get_stats(), returns the
+ * number of resumes then the time spent active in milliseconds, modulo
+ * 2^32, as big-endian uint32 values.
+ * 
+ * @param conn BLE connection handle
+ * @param attr GATT attribute being read
+ * @param buf Buffer to store the read data
+ * @param len Maximum length of data to read
+ * @param offset Offset within the attribute value
+ * @return Number of bytes read, or negative error code on failure
+ */
+static ssize_t read_stats(struct bt_conn *conn,
+			  const struct bt_gatt_attr *attr, void *buf,
+			  uint16_t len, uint16_t offset)
+{
+	power_stats_t stats[POWER_DEVICE_MAX];
+	uint8_t value[POWER_DEVICE_MAX * POWER_STATS_SIZE];
+	size_t count = power_get_stats(stats, ARRAY_SIZE(stats));
+
+	for (size_t i = 0; i < count; i++) {
+		uint8_t *entry = &value[i * POWER_STATS_SIZE];
+
+		sys_put_be32(stats[i].resumes, &entry[0]);
+		sys_put_be32((uint32_t)stats[i].active_ms, &entry[4]);
+	}
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, value,
+				 count * POWER_STATS_SIZE);
+}
@@ -0,0 +1,61 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "channels.h"
+
+/* At most the ADC and one GPIO port per channel */
+#define POWER_DEVICE_MAX (1 + LIONK_CHANNEL_COUNT)
+
+/* Activity of a sampling device since boot */
+typedef struct {
+	const char *name;
+	uint32_t resumes;   // Number of times the device was resumed
+	uint64_t active_ms; // Time spent resumed
+} power_stats_t;
+
+/**
+ * @brief Enables runtime power management of the sampling devices
+ * 
+ * The sampling devices are the ADC and the GPIO ports of the resistor
+ * divider enable pins. They are suspended until power_resume() is called.
+ * A device without power management support stays always on, but its
+ * active time is still accounted. Must be called once the ADC channels
+ * and the GPIO pins are configured.
+ * 
+ * @return 0 on success, negative error code on failure
+ */
+int power_init(void);
+
+/**
+ * @brief Resumes the sampling devices for a sampling cycle
+ * 
+ * Called from the system work queue, and balanced by power_suspend(), even
+ * when a device failed to resume: the devices that did resume are then
+ * suspended again.
+ * 
+ * @return 0 on success, negative error code if a device failed to resume
+ */
+int power_resume(void);
+
+/**
+ * @brief Suspends the sampling devices at the end of a sampling cycle
+ * 
+ * Called from the system work queue.
+ */
+void power_suspend(void);
+
+/**
+ * @brief Returns the activity of the sampling devices
+ * 
+ * The ADC comes first, then the GPIO ports in the order of the channels
+ * they first appear in. This function can be called from any thread.
+ * 
+ * @param stats Filled with the activity of each device
+ * @param max Capacity of stats
+ * @return Number of devices filled
+ */
+size_t power_get_stats(power_stats_t *stats, size_t max);
+
+#endif
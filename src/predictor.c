@@ -0,0 +1,81 @@
+#include "predictor.h"
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+
+/* Fractional bits of the fixed point slope */
+#define SLOPE_SCALE 256
+
+/* Only accessed from the system work queue */
+static uint8_t points;
+static uint32_t last_timestamp;
+static int16_t last_value;
+static int32_t slope;
+
+/**
+ * @brief Returns the temperature predicted by the shared model
+ * 
+ * @param timestamp Time of the prediction, in seconds since boot
+ * @return Predicted temperature
+ */
+int32_t predictor_predict(uint32_t timestamp)
+{
+	int64_t elapsed = (int64_t)timestamp - last_timestamp;
+
+	return last_value + (int32_t)(slope * elapsed / SLOPE_SCALE);
+}
+
+/**
+ * @brief Adds a reported sample to the shared model
+ * 
+ * @param timestamp Time of the sample, in seconds since boot
+ * @param value Temperature of the sample
+ */
+static void adopt(uint32_t timestamp, int16_t value)
+{
+	if (points > 0 && timestamp > last_timestamp) {
+		slope = ((int32_t)value - last_value) * SLOPE_SCALE /
+			(int32_t)(timestamp - last_timestamp);
+		points = 2;
+	} else {
+		slope = 0;
+		points = 1;
+	}
+	last_timestamp = timestamp;
+	last_value = value;
+}
+
+/**
+ * @brief Decides if a sample must be reported to the gateway
+ * 
+ * The device and the gateway run the same predictor on the reported
+ * samples: the temperature is extrapolated from the last two reported
+ * samples (t0, v0) and (t1, v1) in fixed point, with integer divisions
+ * truncating toward zero:
+ * - slope = (v1 - v0) * 256 / (t1 - t0)
+ * - prediction(t) = v1 + slope * (t - t1) / 256
+ * 
+ * With a single reported sample, the prediction is its value. A sample is
+ * reported, and becomes the newest point of the model, when its temperature
+ * is more than CONFIG_LIONK_PREDICTION_BOUND away from the prediction, or
+ * when nothing was reported for CONFIG_LIONK_PREDICTION_MAX_SILENCE seconds.
+ * The series reconstructed by the gateway thus stays within the bound.
+ * 
+ * @param sample New sample
+ * @return true if the sample must be reported, false otherwise
+ */
+bool predictor_update(const sensor_sample_t *sample)
+{
+	const int16_t value =
+		(int16_t)sample->data.values[TEMPERATURE_CHANNEL];
+
+	if (points > 0 &&
+	    abs(value - predictor_predict(sample->timestamp)) <=
+		    CONFIG_LIONK_PREDICTION_BOUND &&
+	    sample->timestamp - last_timestamp <
+		    CONFIG_LIONK_PREDICTION_MAX_SILENCE) {
+		return false;
+	}
+
+	adopt(sample->timestamp, value);
+	return true;
+}
@@ -0,0 +1,37 @@
+#ifndef PREDICTOR_H
+#define PREDICTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sensor.h"
+
+/**
+ * @brief Decides if a sample must be reported to the gateway
+ * 
+ * The device and the gateway run the same predictor on the reported
+ * samples: the temperature is extrapolated from the last two reported
+ * samples (t0, v0) and (t1, v1) in fixed point, with integer divisions
+ * truncating toward zero:
+ * - slope = (v1 - v0) * 256 / (t1 - t0)
+ * - prediction(t) = v1 + slope * (t - t1) / 256
+ * 
+ * With a single reported sample, the prediction is its value. A sample is
+ * reported, and becomes the newest point of the model, when its temperature
+ * is more than CONFIG_LIONK_PREDICTION_BOUND away from the prediction, or
+ * when nothing was reported for CONFIG_LIONK_PREDICTION_MAX_SILENCE seconds.
+ * The series reconstructed by the gateway thus stays within the bound.
+ * 
+ * @param sample New sample
+ * @return true if the sample must be reported, false otherwise
+ */
+bool predictor_update(const sensor_sample_t *sample);
+
+/**
+ * @brief Returns the temperature predicted by the shared model
+ * 
+ * @param timestamp Time of the prediction, in seconds since boot
+ * @return Predicted temperature
+ */
+int32_t predictor_predict(uint32_t timestamp);
+
+#endif
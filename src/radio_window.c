@@ -0,0 +1,153 @@
+#include "radio_window.h"
+#include <mpsl_radio_notification.h>
+#include <zephyr/irq.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(radio_window, LOG_LEVEL_INF);
+
+/* Software interrupt raised by MPSL on radio notifications */
+#define RADIO_NOTIFICATION_IRQN	    SWI3_EGU3_IRQn
+#define RADIO_NOTIFICATION_PRIORITY 5
+
+/*
+ * The notification before a radio event comes this early, so a conversion
+ * started in a quiet window ends before the radio starts.
+ */
+#define RADIO_NOTIFICATION_DISTANCE MPSL_RADIO_NOTIFICATION_DISTANCE_800US
+#define RADIO_NOTIFICATION_LEAD_US  800
+
+/* Longest radio event, the default connection event length of the controller */
+#if defined(CONFIG_BT_CTLR_SDC_MAX_CONN_EVENT_LEN_DEFAULT)
+#define RADIO_EVENT_MAX_US CONFIG_BT_CTLR_SDC_MAX_CONN_EVENT_LEN_DEFAULT
+#else
+#define RADIO_EVENT_MAX_US 7500
+#endif
+
+/*
+ * The radio seen active for longer than this missed its "radio done"
+ * notification.
+ */
+#define RADIO_ACTIVE_MAX_US (RADIO_NOTIFICATION_LEAD_US + RADIO_EVENT_MAX_US)
+
+static struct k_spinlock lock;
+static bool radio_active;
+static uint32_t active_since; // Cycle count of the last "about to start"
+static struct k_work_delayable *waiting_work;
+static radio_window_t waiting_window;
+
+/**
+ * @brief Tells if the radio is active, dropping a stale active state
+ * 
+ * MPSL does not tell the type of a notification, so the state toggles on
+ * each one. After a missed notification the state would stay inverted; an
+ * active state outlasting any radio event is taken for a missed "radio
+ * done" instead, which brings the state back in step. Must be called with
+ * the lock held.
+ * 
+ * @param now Current cycle count
+ * @return true if the radio is active, false if it is idle
+ */
+static bool radio_is_active(uint32_t now)
+{
+	if (radio_active &&
+	    k_cyc_to_us_floor32(now - active_since) > RADIO_ACTIVE_MAX_US) {
+		radio_active = false;
+	}
+	return radio_active;
+}
+
+/**
+ * @brief Handles a radio notification
+ * 
+ * Notifications alternate between "radio about to start" and "radio
+ * done", except after a missed one, see radio_is_active(). Reschedules
+ * the waiting work if its window just opened.
+ * 
+ * @param arg Unused
+ */
+static void radio_notification_isr(const void *arg)
+{
+	(void)arg;
+	uint32_t now = k_cycle_get_32();
+
+	K_SPINLOCK(&lock) {
+		radio_active = !radio_is_active(now);
+		if (radio_active) {
+			active_since = now;
+		}
+		if (waiting_work &&
+		    radio_active == (waiting_window == RADIO_WINDOW_LOADED)) {
+			/* The radio starts RADIO_NOTIFICATION_LEAD_US later */
+			k_work_reschedule(
+				waiting_work,
+				radio_active ?
+					K_USEC(RADIO_NOTIFICATION_LEAD_US) :
+					K_NO_WAIT);
+			waiting_work = NULL;
+		}
+	}
+}
+
+/**
+ * @brief Starts following the radio timeline
+ * 
+ * Subscribes to the MPSL radio notifications, raised before every radio
+ * event and after it ends, whatever the role (advertising, connection,
+ * PAwR synchronization).
+ * 
+ * @return 0 on success, negative error code on failure
+ */
+int radio_window_init(void)
+{
+	IRQ_CONNECT(RADIO_NOTIFICATION_IRQN, RADIO_NOTIFICATION_PRIORITY,
+		    radio_notification_isr, NULL, 0);
+
+	int err = mpsl_radio_notification_cfg_set(
+		MPSL_RADIO_NOTIFICATION_TYPE_INT_ON_BOTH,
+		RADIO_NOTIFICATION_DISTANCE, RADIO_NOTIFICATION_IRQN);
+	if (err) {
+		LOG_ERR("Couldn't subscribe to radio notifications (%d)", err);
+		return err;
+	}
+
+	irq_enable(RADIO_NOTIFICATION_IRQN);
+	return 0;
+}
+
+/**
+ * @brief Waits for a window of the radio timeline
+ * 
+ * If the radio is idle, a quiet window is open: returns true and nothing is
+ * armed. Otherwise the work is rescheduled as soon as the radio goes idle.
+ * A loaded window is never open right away, since the radio may be about
+ * to stop: the work is rescheduled once the next radio event has started.
+ * Only one work waits at a time; a new call replaces it. Without radio
+ * activity, a loaded window never opens, so the caller must bound the
+ * wait. Can be called from any thread.
+ * 
+ * @param window Window to wait for
+ * @param work Work rescheduled when the window opens
+ * @return true if the window is open, false if the work waits for it
+ */
+bool radio_window_wait(radio_window_t window, struct k_work_delayable *work)
+{
+	bool open = false;
+
+	K_SPINLOCK(&lock) {
+		open = window == RADIO_WINDOW_QUIET &&
+		       !radio_is_active(k_cycle_get_32());
+		waiting_work = open ? NULL : work;
+		waiting_window = window;
+	}
+	return open;
+}
+
+/**
+ * @brief Cancels the wait armed by radio_window_wait()
+ */
+void radio_window_cancel(void)
+{
+	K_SPINLOCK(&lock) {
+		waiting_work = NULL;
+	}
+}
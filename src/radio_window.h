@@ -0,0 +1,72 @@
+#ifndef RADIO_WINDOW_H
+#define RADIO_WINDOW_H
+
+#include <stdbool.h>
+#include <zephyr/kernel.h>
+
+/* Part of the radio timeline a conversion must land in */
+typedef enum {
+	RADIO_WINDOW_QUIET,  // Between radio events
+	RADIO_WINDOW_LOADED, // During a radio event
+} radio_window_t;
+
+#if defined(CONFIG_LIONK_RADIO_WINDOWS)
+
+/* Longest wait for a window, after which the conversion runs anyway */
+#define RADIO_WINDOW_MAX_WAIT K_MSEC(CONFIG_LIONK_RADIO_WINDOW_MAX_WAIT)
+
+/**
+ * @brief Starts following the radio timeline
+ * 
+ * Subscribes to the MPSL radio notifications, raised before every radio
+ * event and after it ends, whatever the role (advertising, connection,
+ * PAwR synchronization).
+ * 
+ * @return 0 on success, negative error code on failure
+ */
+int radio_window_init(void);
+
+/**
+ * @brief Waits for a window of the radio timeline
+ * 
+ * If the radio is idle, a quiet window is open: returns true and nothing is
+ * armed. Otherwise the work is rescheduled as soon as the radio goes idle.
+ * A loaded window is never open right away, since the radio may be about
+ * to stop: the work is rescheduled once the next radio event has started.
+ * Only one work waits at a time; a new call replaces it. Without radio
+ * activity, a loaded window never opens, so the caller must bound the
+ * wait. Can be called from any thread.
+ * 
+ * @param window Window to wait for
+ * @param work Work rescheduled when the window opens
+ * @return true if the window is open, false if the work waits for it
+ */
+bool radio_window_wait(radio_window_t window, struct k_work_delayable *work);
+
+/**
+ * @brief Cancels the wait armed by radio_window_wait()
+ */
+void radio_window_cancel(void);
+
+#else
+
+#define RADIO_WINDOW_MAX_WAIT K_NO_WAIT
+
+static inline int radio_window_init(void)
+{
+	return 0;
+}
+
+static inline bool radio_window_wait(radio_window_t window,
+				     struct k_work_delayable *work)
+{
+	return true;
+}
+
+static inline void radio_window_cancel(void)
+{
+}
+
+#endif
+
+#endif
@@ -0,0 +1,149 @@
+#include "sample_buffer.h"
+#include "history.h"
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(sample_buffer, LOG_LEVEL_INF);
+
+/* Only accessed from the system work queue */
+static sensor_sample_t samples_ring[CONFIG_LIONK_SAMPLE_BUFFER_SIZE];
+static size_t head; // Index of the oldest sample
+static size_t count;
+static uint32_t first_seq; // Sequence number of the oldest sample
+
+/**
+ * @brief Appends a sample to the RAM ring buffer
+ * 
+ * When the buffer is full, the oldest sample is moved to the persistent
+ * history log to make room, so samples held back by slow subscribers or
+ * by notification backpressure can still be downloaded in bulk.
+ * 
+ * @param sample Sample to store
+ */
+void sample_buffer_put(const sensor_sample_t *sample)
+{
+	if (count == ARRAY_SIZE(samples_ring)) {
+		int err = history_append(&samples_ring[head]);
+		if (err) {
+			LOG_ERR("Sample buffer full, oldest sample lost (%d)",
+				err);
+		}
+		sample_buffer_drop(1);
+	}
+	samples_ring[(head + count) % ARRAY_SIZE(samples_ring)] = *sample;
+	count++;
+}
+
+/**
+ * @brief Returns the number of samples waiting in the buffer
+ * 
+ * @return Number of buffered samples
+ */
+size_t sample_buffer_count(void)
+{
+	return count;
+}
+
+/**
+ * @brief Returns the sequence number of the oldest buffered sample
+ * 
+ * Every sample put in the buffer gets the next sequence number, so readers
+ * sending the samples at their own pace can each keep a position.
+ * 
+ * @return Sequence number of the oldest sample, or of the next sample put
+ *         if the buffer is empty
+ */
+uint32_t sample_buffer_first_seq(void)
+{
+	return first_seq;
+}
+
+/**
+ * @brief Returns the number of samples at or after a sequence number
+ * 
+ * @param seq Sequence number, not older than sample_buffer_first_seq()
+ * @return Number of buffered samples from seq on
+ */
+static size_t pending_from(uint32_t seq)
+{
+	size_t skip = seq - first_seq;
+
+	return skip < count ? count - skip : 0;
+}
+
+/**
+ * @brief Copies the oldest samples without removing them
+ * 
+ * @param samples Output array, oldest sample first
+ * @param max Maximum number of samples to copy
+ * @return Number of samples copied
+ */
+size_t sample_buffer_peek(sensor_sample_t *samples, size_t max)
+{
+	return sample_buffer_peek_from(first_seq, samples, max);
+}
+
+/**
+ * @brief Copies the samples from a sequence number on without removing them
+ * 
+ * @param seq Sequence number of the first sample to copy, not older than
+ *            sample_buffer_first_seq()
+ * @param samples Output array, oldest sample first
+ * @param max Maximum number of samples to copy
+ * @return Number of samples copied
+ */
+size_t sample_buffer_peek_from(uint32_t seq, sensor_sample_t *samples,
+			       size_t max)
+{
+	size_t n = MIN(max, pending_from(seq));
+	size_t start = head + (seq - first_seq);
+
+	for (size_t i = 0; i < n; i++) {
+		samples[i] =
+			samples_ring[(start + i) % ARRAY_SIZE(samples_ring)];
+	}
+	return n;
+}
+
+/**
+ * @brief Removes the oldest samples from the buffer
+ * 
+ * Typically called once samples returned by sample_buffer_peek() have been
+ * sent.
+ * 
+ * @param n Number of samples to remove
+ */
+void sample_buffer_drop(size_t n)
+{
+	n = MIN(n, count);
+	head = (head + n) % ARRAY_SIZE(samples_ring);
+	count -= n;
+	first_seq += n;
+}
+
+/**
+ * @brief Checks whether the samples from a sequence number should be flushed
+ * 
+ * A flush is due once CONFIG_LIONK_BATCH_SIZE samples are waiting, or once
+ * the oldest of them is at least CONFIG_LIONK_BATCH_MAX_AGE seconds old.
+ * 
+ * @param seq Sequence number of the first sample not sent yet, not older
+ *            than sample_buffer_first_seq()
+ * @param now Current time in seconds since boot
+ * @return true if a flush is due, false otherwise
+ */
+bool sample_buffer_flush_due(uint32_t seq, uint32_t now)
+{
+	size_t pending = pending_from(seq);
+
+	if (pending == 0) {
+		return false;
+	}
+	if (pending >= CONFIG_LIONK_BATCH_SIZE) {
+		return true;
+	}
+
+	size_t index = (head + (seq - first_seq)) % ARRAY_SIZE(samples_ring);
+	return now - samples_ring[index].timestamp >=
+	       CONFIG_LIONK_BATCH_MAX_AGE;
+}
@@ -0,0 +1,81 @@
+#ifndef SAMPLE_BUFFER_H
+#define SAMPLE_BUFFER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "sensor.h"
+
+/**
+ * @brief Appends a sample to the RAM ring buffer
+ * 
+ * When the buffer is full, the oldest sample is moved to the persistent
+ * history log to make room, so samples held back by slow subscribers or
+ * by notification backpressure can still be downloaded in bulk.
+ * 
+ * @param sample Sample to store
+ */
+void sample_buffer_put(const sensor_sample_t *sample);
+
+/**
+ * @brief Returns the number of samples waiting in the buffer
+ * 
+ * @return Number of buffered samples
+ */
+size_t sample_buffer_count(void);
+
+/**
+ * @brief Returns the sequence number of the oldest buffered sample
+ * 
+ * Every sample put in the buffer gets the next sequence number, so readers
+ * sending the samples at their own pace can each keep a position.
+ * 
+ * @return Sequence number of the oldest sample, or of the next sample put
+ *         if the buffer is empty
+ */
+uint32_t sample_buffer_first_seq(void);
+
+/**
+ * @brief Copies the oldest samples without removing them
+ * 
+ * @param samples Output array, oldest sample first
+ * @param max Maximum number of samples to copy
+ * @return Number of samples copied
+ */
+size_t sample_buffer_peek(sensor_sample_t *samples, size_t max);
+
+/**
+ * @brief Copies the samples from a sequence number on without removing them
+ * 
+ * @param seq Sequence number of the first sample to copy, not older than
+ *            sample_buffer_first_seq()
+ * @param samples Output array, oldest sample first
+ * @param max Maximum number of samples to copy
+ * @return Number of samples copied
+ */
+size_t sample_buffer_peek_from(uint32_t seq, sensor_sample_t *samples,
+			       size_t max);
+
+/**
+ * @brief Removes the oldest samples from the buffer
+ * 
+ * Typically called once samples returned by sample_buffer_peek() have been
+ * sent.
+ * 
+ * @param n Number of samples to remove
+ */
+void sample_buffer_drop(size_t n);
+
+/**
+ * @brief Checks whether the samples from a sequence number should be flushed
+ * 
+ * A flush is due once CONFIG_LIONK_BATCH_SIZE samples are waiting, or once
+ * the oldest of them is at least CONFIG_LIONK_BATCH_MAX_AGE seconds old.
+ * 
+ * @param seq Sequence number of the first sample not sent yet, not older
+ *            than sample_buffer_first_seq()
+ * @param now Current time in seconds since boot
+ * @return true if a flush is due, false otherwise
+ */
+bool sample_buffer_flush_due(uint32_t seq, uint32_t now);
+
+#endif
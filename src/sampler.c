@@ -0,0 +1,460 @@
+#include "sampler.h"
+#include "channels.h"
+#include "lionk_adc.h"
+#include "power.h"
+#include "radio_window.h"
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/reboot.h>
+
+LOG_MODULE_REGISTER(sampler, LOG_LEVEL_INF);
+
+/* Upper bound of an ADC scan, after which it is considered lost */
+#define CONVERSION_TIMEOUT_MS	 100
+#define CONVERSION_TIMEOUT	 K_MSEC(CONVERSION_TIMEOUT_MS)
+/* Further wait for a timed out scan, after which the ADC is given up */
+#define CONVERSION_STALL_TIMEOUT K_SECONDS(1)
+
+typedef enum {
+	SAMPLER_IDLE,
+	SAMPLER_SETTLING,
+	SAMPLER_WAITING_RADIO,
+	SAMPLER_CONVERTING,
+} sampler_state_t;
+
+static void schedule_next(struct k_work *work);
+static void start_conversion(struct k_work *work);
+static void finish_cycle(struct k_work *work);
+
+K_WORK_DELAYABLE_DEFINE(schedule_work, schedule_next);
+K_WORK_DELAYABLE_DEFINE(settle_work, start_conversion);
+
+static struct k_work_poll conversion_work;
+static struct k_poll_signal conversion_signal =
+	K_POLL_SIGNAL_INITIALIZER(conversion_signal);
+static struct k_poll_event conversion_events[] = {
+	K_POLL_EVENT_STATIC_INITIALIZER(K_POLL_TYPE_SIGNAL,
+					K_POLL_MODE_NOTIFY_ONLY,
+					&conversion_signal, 0),
+};
+
+/* Periods and deadlines can be changed from any thread */
+static struct k_spinlock lock;
+static uint32_t periods_ms[LIONK_CHANNEL_COUNT];
+static int64_t deadlines_ms[LIONK_CHANNEL_COUNT];
+static sampler_burst_t burst;
+static bool burst_requested;
+
+/* Only accessed from the system work queue */
+static sampler_state_t state = SAMPLER_IDLE;
+static size_t active_channel;
+static int64_t active_deadline_ms;
+static bool bursting;
+static bool timed_out;
+static sampler_done_cb_t done_callback;
+
+/**
+ * @brief Ends the current burst capture and reports its result
+ * 
+ * Powers the divider off and resumes periodic sampling.
+ * 
+ * @param err 0 on success, negative error code otherwise
+ */
+static void complete_burst(int err)
+{
+	sampler_burst_cb_t done;
+
+	gpio_pin_set_dt(&lionk_channels[active_channel].divider_en, 0);
+	power_suspend();
+	state = SAMPLER_IDLE;
+	bursting = false;
+	K_SPINLOCK(&lock) {
+		done = burst.done;
+		burst_requested = false;
+	}
+	k_work_reschedule(&schedule_work, K_NO_WAIT);
+
+	if (done) {
+		done(err);
+	}
+}
+
+/**
+ * @brief Ends the current sampling cycle and reports its result
+ * 
+ * Powers the divider off, moves the channel's deadline one period after the
+ * one just served, unless the period changed meanwhile, and schedules the
+ * next cycle.
+ * 
+ * @param err 0 on success, negative error code otherwise
+ * @param value_mv Converted value, meaningless on failure
+ */
+static void complete_cycle(int err, int32_t value_mv)
+{
+	const size_t channel = active_channel;
+	int64_t now = k_uptime_get();
+
+	if (bursting) {
+		complete_burst(err);
+		return;
+	}
+
+	gpio_pin_set_dt(&lionk_channels[channel].divider_en, 0);
+	power_suspend();
+	state = SAMPLER_IDLE;
+
+	K_SPINLOCK(&lock) {
+		if (deadlines_ms[channel] == active_deadline_ms) {
+			deadlines_ms[channel] += periods_ms[channel];
+		}
+		if (deadlines_ms[channel] < now) {
+			/* Late: restart the period instead of catching up */
+			deadlines_ms[channel] = now + periods_ms[channel];
+		}
+	}
+	k_work_reschedule(&schedule_work, K_NO_WAIT);
+
+	if (done_callback) {
+		done_callback(err, channel, value_mv);
+	}
+}
+
+/**
+ * @brief Starts a sampling cycle on the channel with the earliest deadline
+ * 
+ * If no deadline is reached yet, the work is rescheduled at the earliest
+ * one instead, so the device sleeps until then whatever the number of
+ * channels. The ADC and the GPIO ports are resumed for the cycle; if one
+ * fails to, the cycle completes with its error right away. Only the
+ * divider of the sampled channel is powered, and the settle timeout is
+ * armed instead of sleeping, so the work queue is released immediately.
+ * When deadlines are equal, the channel with the longest period goes
+ * first, so slow values are fresh for the faster channels. A requested
+ * burst goes before any channel.
+ * 
+ * @param work Pointer to the work structure (unused)
+ */
+static void schedule_next(struct k_work *work)
+{
+	(void)work;
+	size_t next = 0;
+	int64_t deadline = INT64_MAX;
+
+	if (state != SAMPLER_IDLE) {
+		/* Rescheduled when the running cycle completes */
+		return;
+	}
+
+	K_SPINLOCK(&lock) {
+		bursting = burst_requested;
+		if (bursting) {
+			next = burst.channel;
+			deadline = INT64_MIN;
+		}
+		for (size_t i = 0; !bursting && i < LIONK_CHANNEL_COUNT; i++) {
+			if (deadlines_ms[i] < deadline ||
+			    (deadlines_ms[i] == deadline &&
+			     periods_ms[i] > periods_ms[next])) {
+				next = i;
+				deadline = deadlines_ms[i];
+			}
+		}
+	}
+
+	if (deadline > k_uptime_get()) {
+		k_work_reschedule(&schedule_work, K_TIMEOUT_ABS_MS(deadline));
+		return;
+	}
+
+	active_channel = next;
+	active_deadline_ms = deadline;
+	int err = power_resume();
+	if (err) {
+		/* Never convert on a suspended ADC: skip the cycle */
+		complete_cycle(err, 0);
+		return;
+	}
+	gpio_pin_set_dt(&lionk_channels[next].divider_en, 1);
+	state = SAMPLER_SETTLING;
+	k_work_schedule(&settle_work,
+			K_MSEC(lionk_channels[next].settle_time_ms));
+}
+
+/**
+ * @brief Returns the part of the radio timeline a channel is converted in
+ * 
+ * @param channel Index of the channel in the zephyr,user io-channels
+ * @return Radio window of the channel's conversions
+ */
+static radio_window_t channel_window(size_t channel)
+{
+	if (IS_ENABLED(CONFIG_LIONK_BATTERY_UNDER_RADIO_LOAD) &&
+	    channel == BATTERY_CHANNEL) {
+		return RADIO_WINDOW_LOADED;
+	}
+	return RADIO_WINDOW_QUIET;
+}
+
+/**
+ * @brief Recovers from an ADC sequence that cannot be waited for
+ * 
+ * The ADC API cannot cancel a sequence, and the sequence holds the ADC
+ * context: any later read would block the system work queue. Rebooting is
+ * the only way to get the ADC back. The samples staged in RAM for the
+ * history log are lost, and the log numbers past them, see history.h.
+ * 
+ * @param err Error that left the sequence unattended
+ */
+static void give_up_adc(int err)
+{
+	LOG_ERR("ADC sequence stuck (%d), rebooting", err);
+	LOG_PANIC();
+	sys_reboot(SYS_REBOOT_COLD);
+}
+
+/**
+ * @brief Second step of a sampling cycle: start the ADC conversion
+ * 
+ * Called once the divider has settled. If the radio window of the channel
+ * is not open, waits for it, for RADIO_WINDOW_MAX_WAIT at most, and is
+ * called again then. Starts an asynchronous conversion of the active
+ * channel and registers the completion handler on its poll signal.
+ * 
+ * @param work Pointer to the work structure (unused)
+ */
+static void start_conversion(struct k_work *work)
+{
+	(void)work;
+
+	if (state == SAMPLER_SETTLING && !bursting &&
+	    !radio_window_wait(channel_window(active_channel), &settle_work)) {
+		state = SAMPLER_WAITING_RADIO;
+		k_work_schedule(&settle_work, RADIO_WINDOW_MAX_WAIT);
+		return;
+	}
+	/* Drop a notification racing with the end of the wait */
+	radio_window_cancel();
+	k_work_cancel_delayable(&settle_work);
+
+	k_poll_signal_reset(&conversion_signal);
+	conversion_events[0].state = K_POLL_STATE_NOT_READY;
+
+	int err;
+	k_timeout_t timeout = CONVERSION_TIMEOUT;
+
+	if (bursting) {
+		/* The burst is immutable until complete_burst() */
+		err = lionk_adc_read_burst_async(
+			burst.channel, burst.interval_us, burst.buffer,
+			burst.count, burst.progress, &conversion_signal);
+		uint64_t burst_ms = (uint64_t)burst.interval_us * burst.count /
+				    USEC_PER_MSEC;
+		timeout = K_MSEC(burst_ms + CONVERSION_TIMEOUT_MS);
+	} else {
+		err = lionk_adc_read_channels_async(
+			BIT(active_channel), CONFIG_LIONK_ADC_OVERSAMPLING,
+			&conversion_signal);
+	}
+	if (err) {
+		complete_cycle(err, 0);
+		return;
+	}
+
+	state = SAMPLER_CONVERTING;
+	err = k_work_poll_submit(&conversion_work, conversion_events,
+				 ARRAY_SIZE(conversion_events), timeout);
+	if (err) {
+		/* The sequence runs, but its end cannot be waited for */
+		give_up_adc(err);
+	}
+}
+
+/**
+ * @brief Last step of a sampling cycle: collect the ADC result
+ * 
+ * Runs when the ADC raised its completion signal, or when the conversion
+ * timed out. Powers the divider off and reports the converted value, or
+ * the end of the burst.
+ * 
+ * A timed out sequence still owns the ADC context and buffer: suspending
+ * the ADC or starting another read would block until it ends. The divider
+ * is powered off, but the cycle only completes, with -ETIMEDOUT, once the
+ * signal is raised; the cycles due meanwhile are skipped. If the signal is
+ * still not raised after CONVERSION_STALL_TIMEOUT, the ADC is given up, see
+ * give_up_adc().
+ * 
+ * @param work Pointer to the work structure (unused)
+ */
+static void finish_cycle(struct k_work *work)
+{
+	(void)work;
+	int32_t values_mv[LIONK_CHANNEL_COUNT];
+	unsigned int signaled;
+	int result;
+	int err;
+
+	k_poll_signal_check(&conversion_signal, &signaled, &result);
+	if (!signaled && timed_out) {
+		give_up_adc(-ETIMEDOUT);
+		return;
+	}
+	if (!signaled) {
+		LOG_ERR("ADC conversion timed out, waiting for it to end");
+		gpio_pin_set_dt(&lionk_channels[active_channel].divider_en, 0);
+		timed_out = true;
+		err = k_work_poll_submit(&conversion_work, conversion_events,
+					 ARRAY_SIZE(conversion_events),
+					 CONVERSION_STALL_TIMEOUT);
+		if (err) {
+			give_up_adc(err);
+		}
+		return;
+	}
+	if (timed_out) {
+		timed_out = false;
+		complete_cycle(-ETIMEDOUT, 0);
+		return;
+	}
+	if (result < 0) {
+		LOG_ERR("ADC conversion failed (%d)", result);
+		complete_cycle(result, 0);
+		return;
+	}
+
+	if (bursting) {
+		complete_burst(0);
+		return;
+	}
+	lionk_adc_read_channels_result(values_mv);
+	complete_cycle(0, values_mv[active_channel]);
+}
+
+/**
+ * @brief Initializes the sampling pipeline
+ * 
+ * Configures the resistor divider enable GPIOs, the ADC channels and the
+ * radio notifications, and suspends the ADC and the GPIO ports until the
+ * first cycle. This must be called before sampler_start().
+ * 
+ * @param done_cb Callback invoked at the end of every sampling cycle
+ * @return 0 on success, -ENODEV if a GPIO is not ready, or other negative
+ *         error code
+ */
+int sampler_init(sampler_done_cb_t done_cb)
+{
+	for (size_t i = 0; i < LIONK_CHANNEL_COUNT; i++) {
+		const struct gpio_dt_spec *divider_en =
+			&lionk_channels[i].divider_en;
+
+		if (!gpio_is_ready_dt(divider_en)) {
+			LOG_ERR("GPIO device %s is not ready",
+				divider_en->port->name);
+			return -ENODEV;
+		}
+
+		int ret = gpio_pin_configure_dt(divider_en,
+						GPIO_OUTPUT_INACTIVE);
+		if (ret < 0) {
+			LOG_ERR("Cannot configure GPIO pin for resistor divider %zu",
+				i);
+			return ret;
+		}
+		periods_ms[i] = lionk_channels[i].default_period_ms;
+	}
+
+	LOG_INF("GPIO pins configured for resistor divider control");
+
+	lionk_adc_setup_all();
+	int err = power_init();
+	if (err) {
+		return err;
+	}
+	if (radio_window_init()) {
+		LOG_WRN("Sampling regardless of radio activity");
+	}
+	k_work_poll_init(&conversion_work, finish_cycle);
+	done_callback = done_cb;
+	return 0;
+}
+
+/**
+ * @brief Starts sampling every channel at its own period
+ * 
+ * Every channel is sampled right away, then each time its period elapses.
+ * Channels are sampled one at a time: each cycle powers the resistor divider
+ * of its channel, lets it settle, then runs an asynchronous ADC conversion,
+ * between radio events when CONFIG_LIONK_RADIO_WINDOWS is enabled. None of
+ * these steps blocks the system work queue. The callback given to
+ * sampler_init() is invoked once per cycle.
+ */
+void sampler_start(void)
+{
+	int64_t now = k_uptime_get();
+
+	K_SPINLOCK(&lock) {
+		for (size_t i = 0; i < LIONK_CHANNEL_COUNT; i++) {
+			deadlines_ms[i] = now;
+		}
+	}
+	k_work_reschedule(&schedule_work, K_NO_WAIT);
+}
+
+/**
+ * @brief Changes the sampling period of a channel
+ * 
+ * The channel is next sampled one new period from now. This function can
+ * be called from any thread.
+ * 
+ * @param channel Index of the channel in the zephyr,user io-channels
+ * @param period_ms New sampling period in milliseconds
+ */
+void sampler_set_period(size_t channel, uint32_t period_ms)
+{
+	if (channel >= LIONK_CHANNEL_COUNT) {
+		return;
+	}
+
+	K_SPINLOCK(&lock) {
+		periods_ms[channel] = period_ms;
+		deadlines_ms[channel] = k_uptime_get() + period_ms;
+	}
+	k_work_reschedule(&schedule_work, K_NO_WAIT);
+}
+
+/**
+ * @brief Requests a burst capture of a channel
+ * 
+ * The burst runs as soon as the current sampling cycle ends: the divider of
+ * the channel is powered and settles, then the channel is sampled count
+ * times at the given interval in a single ADC sequence, regardless of
+ * radio activity. Periodic sampling is suspended meanwhile and resumes
+ * afterwards, late channels being sampled first. The buffer must stay
+ * valid until the done callback is invoked. This function can be called
+ * from any thread.
+ * 
+ * @param new_burst Burst to capture, copied
+ * @return 0 on success, -EINVAL if the channel is out of range, -EBUSY if
+ *         a burst is already requested or running
+ */
+int sampler_request_burst(const sampler_burst_t *new_burst)
+{
+	int err = 0;
+
+	if (new_burst->channel >= LIONK_CHANNEL_COUNT) {
+		return -EINVAL;
+	}
+
+	K_SPINLOCK(&lock) {
+		if (burst_requested) {
+			err = -EBUSY;
+		} else {
+			burst = *new_burst;
+			burst_requested = true;
+		}
+	}
+	if (!err) {
+		k_work_reschedule(&schedule_work, K_NO_WAIT);
+	}
+	return err;
+}
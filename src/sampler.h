@@ -0,0 +1,91 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/drivers/adc.h>
+
+/**
+ * @brief Callback invoked when a sampling cycle completes
+ * 
+ * Runs on the system work queue, once per sampled channel.
+ * 
+ * @param err 0 on success, negative error code if the conversion failed
+ * @param channel Index of the channel in the zephyr,user io-channels
+ * @param value_mv Millivolt value of the channel, meaningless on failure
+ */
+typedef void (*sampler_done_cb_t)(int err, size_t channel, int32_t value_mv);
+
+/**
+ * @brief Callback invoked when a burst capture completes
+ * 
+ * Runs on the system work queue.
+ * 
+ * @param err 0 on success, negative error code if the capture failed
+ */
+typedef void (*sampler_burst_cb_t)(int err);
+
+/* Burst capture of one channel, see sampler_request_burst() */
+typedef struct {
+	size_t channel;
+	uint32_t interval_us;		// Interval between two samples
+	int16_t *buffer;		// Receives count raw samples
+	size_t count;
+	adc_sequence_callback progress; // Called after each sample, or NULL
+	sampler_burst_cb_t done;
+} sampler_burst_t;
+
+/**
+ * @brief Initializes the sampling pipeline
+ * 
+ * Configures the resistor divider enable GPIOs, the ADC channels and the
+ * radio notifications, and suspends the ADC and the GPIO ports until the
+ * first cycle. This must be called before sampler_start().
+ * 
+ * @param done_cb Callback invoked at the end of every sampling cycle
+ * @return 0 on success, -ENODEV if a GPIO is not ready, or other negative
+ *         error code
+ */
+int sampler_init(sampler_done_cb_t done_cb);
+
+/**
+ * @brief Starts sampling every channel at its own period
+ * 
+ * Every channel is sampled right away, then each time its period elapses.
+ * Channels are sampled one at a time: each cycle powers the resistor divider
+ * of its channel, lets it settle, then runs an asynchronous ADC conversion,
+ * between radio events when CONFIG_LIONK_RADIO_WINDOWS is enabled. None of
+ * these steps blocks the system work queue. The callback given to
+ * sampler_init() is invoked once per cycle.
+ */
+void sampler_start(void);
+
+/**
+ * @brief Changes the sampling period of a channel
+ * 
+ * The channel is next sampled one new period from now. This function can
+ * be called from any thread.
+ * 
+ * @param channel Index of the channel in the zephyr,user io-channels
+ * @param period_ms New sampling period in milliseconds
+ */
+void sampler_set_period(size_t channel, uint32_t period_ms);
+
+/**
+ * @brief Requests a burst capture of a channel
+ * 
+ * The burst runs as soon as the current sampling cycle ends: the divider of
+ * the channel is powered and settles, then the channel is sampled count
+ * times at the given interval in a single ADC sequence, regardless of
+ * radio activity. Periodic sampling is suspended meanwhile and resumes
+ * afterwards, late channels being sampled first. The buffer must stay
+ * valid until the done callback is invoked. This function can be called
+ * from any thread.
+ * 
+ * @param new_burst Burst to capture, copied
+ * @return 0 on success, -EINVAL if the channel is out of range, -EBUSY if
+ *         a burst is already requested or running
+ */
+int sampler_request_burst(const sampler_burst_t *new_burst);
+
+#endif
@@ -0,0 +1,59 @@
+#include "sensor.h"
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+/*
+ * Double-buffered snapshot of the latest sample set. The sampler writes the
+ * slot of the next sequence number, the one readers are not copying, then
+ * publishes the sequence number. A reader copies the slot of the published
+ * sequence number and checks that no other set was published meanwhile,
+ * which is the only way the writer could have reused that slot. Unlike a
+ * plain sequence lock, a reader preempting the writer never spins.
+ */
+static sensor_snapshot_t slots[2];
+static atomic_t published;
+
+/**
+ * @brief Publishes the latest sample set
+ * 
+ * The set is written to the snapshot slot readers are not using, then made
+ * current with a single atomic store, so the sampler never waits for a
+ * reader. Must only be called from one thread, the system work queue.
+ * 
+ * @param data Converted values of every channel
+ * @param timestamp Seconds since boot when the set was taken
+ */
+void sensor_publish(const sensor_data_t *data, uint32_t timestamp)
+{
+	uint32_t seq = (uint32_t)atomic_get(&published) + 1;
+	sensor_snapshot_t *slot = &slots[seq % ARRAY_SIZE(slots)];
+
+	slot->seq = seq;
+	slot->timestamp = timestamp;
+	slot->data = *data;
+	/* The atomic store orders the slot writes before it */
+	atomic_set(&published, seq);
+}
+
+/**
+ * @brief Takes a consistent copy of the latest sample set
+ * 
+ * Lock-free and callable from any thread, including the Bluetooth threads:
+ * the copy is retried whenever the sampler published a set while it was
+ * taken, so every value of the copy comes from the same set. Only a second
+ * publication would reuse the slot being copied; retrying on the first one
+ * is cheaper than telling them apart, and as rare as the sampling.
+ * 
+ * @param snapshot Copy of the latest sample set
+ */
+void sensor_read(sensor_snapshot_t *snapshot)
+{
+	atomic_val_t seq;
+
+	do {
+		seq = atomic_get(&published);
+		*snapshot = slots[(uint32_t)seq % ARRAY_SIZE(slots)];
+		/* Finish the copy before checking it is still valid */
+		compiler_barrier();
+	} while (atomic_get(&published) != seq);
+}
@@ -2,17 +2,52 @@
 #define SENSOR_H
 #include <stdint.h>
 #include <stdbool.h>
+#include "channels.h"
 
 typedef struct {
-	uint16_t battery_mv; // Battery level in mv
-	uint16_t temperature; // Divide by 100 to get the temperature in °C
+	/*
+	 * Converted value of each channel, indexed like the zephyr,user
+	 * io-channels: the temperature in centi-degrees Celsius (stored as
+	 * int16_t), then the battery level in mV
+	 */
+	uint16_t values[LIONK_CHANNEL_COUNT];
 } sensor_data_t;
-typedef enum {
-	DISCONNECTED,
-	ADVERTISING,
-	CONNECTED,
-} sensor_state_t;
 
-extern sensor_data_t sensor_data;
+typedef struct {
+	uint32_t timestamp; // Seconds since boot when the sample was taken
+	sensor_data_t data;
+} sensor_sample_t;
+
+/* Latest sample set, as published by the sampler */
+typedef struct {
+	uint32_t seq; // Number of sample sets published, 0 before the first
+	uint32_t timestamp; // Seconds since boot when the set was taken
+	sensor_data_t data;
+} sensor_snapshot_t;
+
+/**
+ * @brief Publishes the latest sample set
+ * 
+ * The set is written to the snapshot slot readers are not using, then made
+ * current with a single atomic store, so the sampler never waits for a
+ * reader. Must only be called from one thread, the system work queue.
+ * 
+ * @param data Converted values of every channel
+ * @param timestamp Seconds since boot when the set was taken
+ */
+void sensor_publish(const sensor_data_t *data, uint32_t timestamp);
+
+/**
+ * @brief Takes a consistent copy of the latest sample set
+ * 
+ * Lock-free and callable from any thread, including the Bluetooth threads:
+ * the copy is retried whenever the sampler published a set while it was
+ * taken, so every value of the copy comes from the same set. Only a second
+ * publication would reuse the slot being copied; retrying on the first one
+ * is cheaper than telling them apart, and as rare as the sampling.
+ * 
+ * @param snapshot Copy of the latest sample set
+ */
+void sensor_read(sensor_snapshot_t *snapshot);
 
 #endif
@@ -0,0 +1,278 @@
+#include "stats.h"
+#include "ble.h"
+#include <string.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+LOG_MODULE_REGISTER(stats, LOG_LEVEL_INF);
+
+/*
+ * Rolling statistics, so the gateway can poll aggregates instead of pulling
+ * every sample.
+ * 
+ * Three windows of CONFIG_LIONK_STATS_SHORT_WINDOW, _MEDIUM_WINDOW and
+ * _LONG_WINDOW seconds tumble over the samples, each aligned on a multiple
+ * of its length since boot. Reading the statistics characteristic returns
+ * the record of the last closed window of each length, shortest first.
+ * Subscribed centrals are notified the record of a window as it closes:
+ * - Byte 0: Index of the window, 0 for the shortest
+ * - Bytes 1-4: Start of the window in seconds since boot (big-endian uint32)
+ * - Bytes 5-6: Number of samples, saturated (big-endian uint16)
+ * - Then, for each channel: the minimum, maximum, mean and population
+ *   standard deviation in the unit of the channel (big-endian, int16 for
+ *   the temperature, uint16 for the other channels)
+ * 
+ * The values of a window without samples are all zero.
+ */
+
+#define STATS_WINDOW_COUNT  3
+#define STATS_HEADER_SIZE   7
+#define STATS_CHANNEL_SIZE  8
+#define STATS_RECORD_SIZE \
+	(STATS_HEADER_SIZE + LIONK_CHANNEL_COUNT * STATS_CHANNEL_SIZE)
+
+/* Fractional bits of the running mean and sum of squared deviations */
+#define STATS_FRAC_BITS	    8
+
+/* Accumulator of a channel over a window */
+typedef struct {
+	uint32_t count;
+	int32_t min;
+	int32_t max;
+	int64_t mean; // Q8 in the unit of the channel
+	uint64_t m2; // Sum of squared deviations from the mean, Q8
+} stats_acc_t;
+
+typedef struct {
+	uint32_t length; // In seconds
+	uint32_t start; // Of the running window, in seconds since boot
+	stats_acc_t accs[LIONK_CHANNEL_COUNT];
+	uint8_t record[STATS_RECORD_SIZE]; // Of the last closed window
+} stats_window_t;
+
+static ssize_t read_stats(struct bt_conn *conn,
+			  const struct bt_gatt_attr *attr, void *buf,
+			  uint16_t len, uint16_t offset);
+
+BT_GATT_SERVICE_DEFINE(stats_svc, BT_GATT_PRIMARY_SERVICE(BT_UUID_STATS_SVC),
+		       BT_GATT_CHARACTERISTIC(BT_UUID_STATS,
+					      BT_GATT_CHRC_READ |
+						      BT_GATT_CHRC_NOTIFY,
+					      BT_GATT_PERM_READ, read_stats,
+					      NULL, NULL),
+		       BT_GATT_CCC(NULL,
+				   BT_GATT_PERM_READ | BT_GATT_PERM_WRITE));
+
+/* Updated from the system work queue, records also read from any thread */
+static struct k_spinlock lock;
+static stats_window_t windows[STATS_WINDOW_COUNT] = {
+	{ .length = CONFIG_LIONK_STATS_SHORT_WINDOW, .record = { 0 } },
+	{ .length = CONFIG_LIONK_STATS_MEDIUM_WINDOW, .record = { 1 } },
+	{ .length = CONFIG_LIONK_STATS_LONG_WINDOW, .record = { 2 } },
+};
+
+/**
+ * @brief Returns a channel value as a signed number
+ * 
+ * @param channel Index of the channel in the zephyr,user io-channels
+ * @param value Value as stored in sensor_data_t
+ * @return The temperature as an int16, the other channels as a uint16
+ */
+static int32_t channel_value(size_t channel, uint16_t value)
+{
+	return channel == TEMPERATURE_CHANNEL ? (int16_t)value : value;
+}
+
+/**
+ * @brief Adds a value to an accumulator
+ * 
+ * Welford's update in fixed point: the mean moves toward the value by
+ * delta / n, and the sum of squared deviations grows by the product of
+ * the deviations from the old and the new mean. Both deviations have the
+ * same sign, so the sum never decreases. With 16-bit values, the sum stays
+ * far below 2^64 for any realistic number of samples.
+ * 
+ * @param acc Accumulator
+ * @param value Channel value
+ */
+static void accumulate(stats_acc_t *acc, int32_t value)
+{
+	int64_t x = (int64_t)value << STATS_FRAC_BITS;
+
+	acc->count++;
+	if (acc->count == 1) {
+		*acc = (stats_acc_t){
+			.count = 1,
+			.min = value,
+			.max = value,
+			.mean = x,
+		};
+		return;
+	}
+	acc->min = MIN(acc->min, value);
+	acc->max = MAX(acc->max, value);
+
+	int64_t delta = x - acc->mean;
+	acc->mean += delta / (int64_t)acc->count;
+	acc->m2 += (uint64_t)(delta * (x - acc->mean)) >> STATS_FRAC_BITS;
+}
+
+/**
+ * @brief Computes the integer square root
+ * 
+ * @param value Radicand
+ * @return Largest integer whose square is not above value
+ */
+static uint32_t isqrt(uint64_t value)
+{
+	uint64_t root = 0;
+	uint64_t bit = 1ULL << 62;
+
+	while (bit > value) {
+		bit >>= 2;
+	}
+	while (bit) {
+		if (value >= root + bit) {
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return root;
+}
+
+/**
+ * @brief Rounds a Q8 number to the nearest integer
+ * 
+ * @param value Q8 number
+ * @return Nearest integer, halves away from zero
+ */
+static int32_t round_q8(int64_t value)
+{
+	int64_t half = 1 << (STATS_FRAC_BITS - 1);
+
+	return (value >= 0 ? value + half : value - half) /
+	       (1 << STATS_FRAC_BITS);
+}
+
+/**
+ * @brief Encodes the statistics of a window
+ * 
+ * @param index Index of the window
+ * @param window Window being closed
+ * @param record Encoded statistics
+ */
+static void encode_window(size_t index, const stats_window_t *window,
+			  uint8_t *record)
+{
+	uint8_t *out = &record[STATS_HEADER_SIZE];
+
+	record[0] = index;
+	sys_put_be32(window->start, &record[1]);
+	sys_put_be16(MIN(window->accs[0].count, UINT16_MAX), &record[5]);
+
+	for (size_t i = 0; i < LIONK_CHANNEL_COUNT; i++) {
+		const stats_acc_t *acc = &window->accs[i];
+		uint32_t stddev = 0;
+
+		if (acc->count > 0) {
+			/* sqrt(variance * 2^16) is the Q8 deviation */
+			stddev = isqrt((acc->m2 / acc->count)
+				       << STATS_FRAC_BITS);
+		}
+		sys_put_be16(acc->min, &out[0]);
+		sys_put_be16(acc->max, &out[2]);
+		sys_put_be16(round_q8(acc->mean), &out[4]);
+		sys_put_be16(round_q8(stddev), &out[6]);
+		out += STATS_CHANNEL_SIZE;
+	}
+}
+
+/**
+ * @brief Closes a window and starts the one holding a timestamp
+ * 
+ * The statistics of the window replace its record, and are notified to the
+ * subscribed centrals.
+ * 
+ * @param index Index of the window
+ * @param timestamp Time of the sample past the end of the window
+ */
+static void close_window(size_t index, uint32_t timestamp)
+{
+	stats_window_t *window = &windows[index];
+	uint8_t record[STATS_RECORD_SIZE];
+
+	encode_window(index, window, record);
+	K_SPINLOCK(&lock) {
+		memcpy(window->record, record, sizeof(record));
+	}
+	memset(window->accs, 0, sizeof(window->accs));
+	window->start = timestamp - timestamp % window->length;
+
+	int err = bt_gatt_notify(NULL, &stats_svc.attrs[2], record,
+				 sizeof(record));
+	if (err && err != -ENOTCONN) {
+		LOG_WRN("Couldn't notify statistics (%d)", err);
+	}
+}
+
+/**
+ * @brief Adds a sample to the rolling statistics of every window
+ * 
+ * Each window keeps, for every channel, the minimum, the maximum, and the
+ * mean and variance updated with Welford's algorithm in fixed point, in
+ * constant memory. Windows are aligned on the uptime; the first sample
+ * past the end of a window closes it, its statistics become the ones read
+ * on the statistics characteristic and are notified to the subscribed
+ * centrals. Must be called from the system work queue.
+ * 
+ * @param sample New sample
+ */
+void stats_update(const sensor_sample_t *sample)
+{
+	for (size_t w = 0; w < ARRAY_SIZE(windows); w++) {
+		stats_window_t *window = &windows[w];
+
+		if (sample->timestamp - window->start >= window->length) {
+			close_window(w, sample->timestamp);
+		}
+		for (size_t i = 0; i < LIONK_CHANNEL_COUNT; i++) {
+			accumulate(&window->accs[i],
+				   channel_value(i, sample->data.values[i]));
+		}
+	}
+}
+
+/**
+ * @brief Reads the statistics characteristic
+ * 
+ * Returns the record of the last closed window of each length, shortest
+ * first. The value is longer than the default ATT MTU, so centrals read it
+ * with long reads or after an MTU exchange.
+ * 
+ * @param conn BLE connection handle
+ * @param attr GATT attribute being read
+ * @param buf Buffer to store the read data
+ * @param len Maximum length of data to read
+ * @param offset Offset within the attribute value
+ * @return Number of bytes read, or negative error code on failure
+ */
+static ssize_t read_stats(struct bt_conn *conn,
+			  const struct bt_gatt_attr *attr, void *buf,
+			  uint16_t len, uint16_t offset)
+{
+	uint8_t value[STATS_WINDOW_COUNT * STATS_RECORD_SIZE];
+
+	K_SPINLOCK(&lock) {
+		for (size_t w = 0; w < ARRAY_SIZE(windows); w++) {
+			memcpy(&value[w * STATS_RECORD_SIZE],
+			       windows[w].record, STATS_RECORD_SIZE);
+		}
+	}
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, value,
+				 sizeof(value));
+}
@@ -0,0 +1,30 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "sensor.h"
+
+#if defined(CONFIG_LIONK_STATS)
+
+/**
+ * @brief Adds a sample to the rolling statistics of every window
+ * 
+ * Each window keeps, for every channel, the minimum, the maximum, and the
+ * mean and variance updated with Welford's algorithm in fixed point, in
+ * constant memory. Windows are aligned on the uptime; the first sample
+ * past the end of a window closes it, its statistics become the ones read
+ * on the statistics characteristic and are notified to the subscribed
+ * centrals. Must be called from the system work queue.
+ * 
+ * @param sample New sample
+ */
+void stats_update(const sensor_sample_t *sample);
+
+#else
+
+static inline void stats_update(const sensor_sample_t *sample)
+{
+}
+
+#endif
+
+#endif
@@ -0,0 +1,307 @@
+#include "temperature.h"
+#include "ble.h"
+#include "temperature_lut.h"
+#include <string.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/sys/byteorder.h>
+
+LOG_MODULE_REGISTER(temperature, LOG_LEVEL_INF);
+
+#define CALIBRATION_SUBTREE "cal"
+#define CALIBRATION_NAME    "temp"
+
+/* Calibration as read and written on the calibration characteristic */
+#define CALIBRATION_SIZE    8
+
+/* Fractional bits of the calibration slope */
+#define SLOPE_SHIFT	    16
+
+/* Largest accepted slope: the correction never outgrows the temperature */
+#define SLOPE_MAX	    (1 << SLOPE_SHIFT)
+
+#define LUT_STEP_MASK	    BIT_MASK(TEMPERATURE_LUT_STEP_SHIFT)
+
+static ssize_t read_calibration(struct bt_conn *conn,
+				const struct bt_gatt_attr *attr, void *buf,
+				uint16_t len, uint16_t offset);
+static ssize_t write_calibration(struct bt_conn *conn,
+				 const struct bt_gatt_attr *attr,
+				 const void *buf, uint16_t len,
+				 uint16_t offset, uint8_t flags);
+static void save_calibration(struct k_work *work);
+
+BT_GATT_SERVICE_DEFINE(calibration_svc,
+		       BT_GATT_PRIMARY_SERVICE(BT_UUID_CALIBRATION_SVC),
+		       BT_GATT_CHARACTERISTIC(BT_UUID_CALIBRATION,
+					      BT_GATT_CHRC_READ |
+						      BT_GATT_CHRC_WRITE,
+					      BT_GATT_PERM_READ |
+						      BT_GATT_PERM_WRITE,
+					      read_calibration,
+					      write_calibration, NULL));
+
+K_WORK_DEFINE(save_work, save_calibration);
+
+/* Correction applied by temperature_convert(), derived from calibration */
+typedef struct {
+	int32_t reference;
+	int32_t offset;
+	int32_t slope; // Change of the offset per centi-degree, fixed point
+} correction_t;
+
+static struct k_spinlock lock;
+static temperature_calibration_t calibration;
+static correction_t correction;
+
+/**
+ * @brief Derives the correction applied on every conversion
+ * 
+ * @param cal Calibration points
+ * @param out Correction to fill
+ * @return 0 on success, -EINVAL if the calibration points are inconsistent
+ *         or the correction changes faster than the temperature itself
+ */
+static int derive_correction(const temperature_calibration_t *cal,
+			     correction_t *out)
+{
+	int32_t span = cal->reference2 - cal->reference1;
+	int64_t slope = 0;
+
+	if (span == 0 && cal->offset1 != cal->offset2) {
+		return -EINVAL;
+	}
+	if (span) {
+		slope = ((int64_t)cal->offset2 - cal->offset1) *
+			(1 << SLOPE_SHIFT) / span;
+	}
+	if (slope > SLOPE_MAX || slope < -SLOPE_MAX) {
+		return -EINVAL;
+	}
+
+	out->reference = cal->reference1;
+	out->offset = cal->offset1;
+	out->slope = (int32_t)slope;
+	return 0;
+}
+
+/**
+ * @brief Converts the voltage of the temperature channel to centi-degrees
+ * 
+ * The voltage is looked up in a piecewise-linear table generated at build
+ * time for the configured front end (TMP36, NTC or Steinhart-Hart
+ * thermistor), then corrected with the device calibration. Only integer
+ * arithmetic is used: the table is evenly spaced by a power of two
+ * millivolts, so finding the segment takes a shift.
+ * 
+ * A thermistor divider outputs a fraction of its supply, so its reading is
+ * first rescaled from the measured supply to the nominal one the table was
+ * generated for.
+ * 
+ * @param value_mv Millivolt value of the temperature channel
+ * @param supply_mv Measured supply of the thermistor divider, 0 if unknown
+ * @return Temperature in signed centi-degrees Celsius
+ */
+int32_t temperature_convert(int32_t value_mv, int32_t supply_mv)
+{
+	correction_t cor;
+	int32_t centi;
+
+	if (value_mv < 0) {
+		value_mv = 0;
+	}
+#if defined(CONFIG_LIONK_TEMPERATURE_NTC) || \
+	defined(CONFIG_LIONK_TEMPERATURE_THERMISTOR)
+	if (supply_mv > 0) {
+		value_mv = (int64_t)value_mv *
+			   CONFIG_LIONK_THERMISTOR_SUPPLY_MV / supply_mv;
+	}
+#else
+	ARG_UNUSED(supply_mv);
+#endif
+
+	size_t index = value_mv >> TEMPERATURE_LUT_STEP_SHIFT;
+	if (index >= TEMPERATURE_LUT_SIZE - 1) {
+		centi = temperature_lut[TEMPERATURE_LUT_SIZE - 1];
+	} else {
+		int32_t low = temperature_lut[index];
+		int32_t high = temperature_lut[index + 1];
+		int32_t fraction = value_mv & LUT_STEP_MASK;
+
+		centi = low + (high - low) * fraction /
+				      (1 << TEMPERATURE_LUT_STEP_SHIFT);
+	}
+
+	K_SPINLOCK(&lock) {
+		cor = correction;
+	}
+	return centi + cor.offset +
+	       (int32_t)(((int64_t)(centi - cor.reference) * cor.slope) >>
+			 SLOPE_SHIFT);
+}
+
+/**
+ * @brief Writes the current calibration to settings
+ * 
+ * Runs on the system work queue, so a write from a Bluetooth callback does
+ * not wait for flash.
+ * 
+ * @param work Pointer to the work structure (unused)
+ */
+static void save_calibration(struct k_work *work)
+{
+	temperature_calibration_t saved;
+
+	(void)work;
+	K_SPINLOCK(&lock) {
+		saved = calibration;
+	}
+
+	int err = settings_save_one(CALIBRATION_SUBTREE "/" CALIBRATION_NAME,
+				    &saved, sizeof(saved));
+	if (err) {
+		LOG_ERR("Couldn't save temperature calibration (%d)", err);
+	}
+}
+
+/**
+ * @brief Changes and persists the device calibration
+ * 
+ * The correction is interpolated linearly between the two points and
+ * extrapolated outside of them. With both references equal, the first
+ * offset applies everywhere.
+ * 
+ * @param new_calibration New calibration
+ * @return 0 on success, -EINVAL if the references are equal but not the
+ *         offsets, or if the correction changes by more than a degree per
+ *         degree
+ */
+int temperature_set_calibration(
+	const temperature_calibration_t *new_calibration)
+{
+	correction_t new_correction;
+
+	if (derive_correction(new_calibration, &new_correction)) {
+		return -EINVAL;
+	}
+
+	K_SPINLOCK(&lock) {
+		calibration = *new_calibration;
+		correction = new_correction;
+	}
+	k_work_submit(&save_work);
+	LOG_INF("Temperature calibration %d%+d, %d%+d",
+		new_calibration->reference1, new_calibration->offset1,
+		new_calibration->reference2, new_calibration->offset2);
+	return 0;
+}
+
+/**
+ * @brief Reads the device calibration
+ * 
+ * The value holds the first reference, the first offset, the second
+ * reference and the second offset, each in centi-degrees as a big-endian
+ * int16.
+ * 
+ * @param conn BLE connection handle
+ * @param attr GATT attribute being read
+ * @param buf Buffer to store the read data
+ * @param len Maximum length of data to read
+ * @param offset Offset within the attribute value
+ * @return Number of bytes read, or negative error code on failure
+ */
+static ssize_t read_calibration(struct bt_conn *conn,
+				const struct bt_gatt_attr *attr, void *buf,
+				uint16_t len, uint16_t offset)
+{
+	temperature_calibration_t current;
+	uint8_t value[CALIBRATION_SIZE];
+
+	K_SPINLOCK(&lock) {
+		current = calibration;
+	}
+	sys_put_be16(current.reference1, &value[0]);
+	sys_put_be16(current.offset1, &value[2]);
+	sys_put_be16(current.reference2, &value[4]);
+	sys_put_be16(current.offset2, &value[6]);
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, value,
+				 sizeof(value));
+}
+
+/**
+ * @brief Writes the device calibration
+ * 
+ * @param conn BLE connection handle
+ * @param attr GATT attribute being written
+ * @param buf Written value, laid out like the read value
+ * @param len Length of the written value
+ * @param offset Write offset
+ * @param flags Write flags
+ * @return Number of bytes written, or a negative ATT error code
+ */
+static ssize_t write_calibration(struct bt_conn *conn,
+				 const struct bt_gatt_attr *attr,
+				 const void *buf, uint16_t len,
+				 uint16_t offset, uint8_t flags)
+{
+	const uint8_t *value = buf;
+
+	if (offset) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+	if (len != CALIBRATION_SIZE) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	const temperature_calibration_t new_calibration = {
+		.reference1 = sys_get_be16(&value[0]),
+		.offset1 = sys_get_be16(&value[2]),
+		.reference2 = sys_get_be16(&value[4]),
+		.offset2 = sys_get_be16(&value[6]),
+	};
+	if (temperature_set_calibration(&new_calibration)) {
+		return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+	}
+	return len;
+}
+
+/**
+ * @brief Settings handler restoring the device calibration
+ * 
+ * @param name Key relative to the calibration subtree
+ * @param len Length of the stored value
+ * @param read_cb Function reading the stored value
+ * @param cb_arg Argument of read_cb
+ * @return 0 on success, negative error code otherwise
+ */
+static int calibration_set(const char *name, size_t len,
+			   settings_read_cb read_cb, void *cb_arg)
+{
+	temperature_calibration_t stored;
+	correction_t stored_correction;
+
+	if (strcmp(name, CALIBRATION_NAME) || len != sizeof(stored)) {
+		LOG_WRN("Ignoring calibration setting %s", name);
+		return 0;
+	}
+
+	ssize_t ret = read_cb(cb_arg, &stored, sizeof(stored));
+	if (ret < 0) {
+		return ret;
+	}
+	if (derive_correction(&stored, &stored_correction)) {
+		LOG_WRN("Ignoring invalid temperature calibration");
+		return 0;
+	}
+
+	K_SPINLOCK(&lock) {
+		calibration = stored;
+		correction = stored_correction;
+	}
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(temperature, CALIBRATION_SUBTREE, NULL,
+			       calibration_set, NULL, NULL);
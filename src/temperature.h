@@ -0,0 +1,48 @@
+#ifndef TEMPERATURE_H
+#define TEMPERATURE_H
+
+#include <stdint.h>
+
+/* Two-point calibration of the temperature channel, in centi-degrees */
+typedef struct {
+	int16_t reference1; // Uncalibrated temperature of the first point
+	int16_t offset1;    // Correction to apply at the first point
+	int16_t reference2; // Uncalibrated temperature of the second point
+	int16_t offset2;    // Correction to apply at the second point
+} temperature_calibration_t;
+
+/**
+ * @brief Converts the voltage of the temperature channel to centi-degrees
+ * 
+ * The voltage is looked up in a piecewise-linear table generated at build
+ * time for the configured front end (TMP36, NTC or Steinhart-Hart
+ * thermistor), then corrected with the device calibration. Only integer
+ * arithmetic is used: the table is evenly spaced by a power of two
+ * millivolts, so finding the segment takes a shift.
+ * 
+ * A thermistor divider outputs a fraction of its supply, so its reading is
+ * first rescaled from the measured supply to the nominal one the table was
+ * generated for.
+ * 
+ * @param value_mv Millivolt value of the temperature channel
+ * @param supply_mv Measured supply of the thermistor divider, 0 if unknown
+ * @return Temperature in signed centi-degrees Celsius
+ */
+int32_t temperature_convert(int32_t value_mv, int32_t supply_mv);
+
+/**
+ * @brief Changes and persists the device calibration
+ * 
+ * The correction is interpolated linearly between the two points and
+ * extrapolated outside of them. With both references equal, the first
+ * offset applies everywhere.
+ * 
+ * @param new_calibration New calibration
+ * @return 0 on success, -EINVAL if the references are equal but not the
+ *         offsets, or if the correction changes by more than a degree per
+ *         degree
+ */
+int temperature_set_calibration(
+	const temperature_calibration_t *new_calibration);
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * The burst module is built together with its test to reach its static
+ * stream. The ADC is emulated; the Bluetooth stack and the sampler are
+ * replaced: the ADC sequence is started right away, and every notification
+ * is recorded.
+ */
+#include "burst.c"
+
+#include <zephyr/drivers/adc/adc_emul.h>
+#include <zephyr/fff.h>
+#include <zephyr/ztest.h>
+
+DEFINE_FFF_GLOBALS;
+
+FAKE_VOID_FUNC(ble_request_throughput, struct bt_conn *);
+FAKE_VOID_FUNC(ble_release_throughput, struct bt_conn *);
+FAKE_VALUE_FUNC(struct bt_conn *, bt_conn_ref, struct bt_conn *);
+FAKE_VOID_FUNC(bt_conn_unref, struct bt_conn *);
+FAKE_VALUE_FUNC(uint16_t, bt_gatt_get_mtu, struct bt_conn *);
+FAKE_VALUE_FUNC(bool, bt_gatt_is_subscribed, struct bt_conn *,
+		const struct bt_gatt_attr *, uint16_t);
+FAKE_VALUE_FUNC(int, bt_gatt_notify_cb, struct bt_conn *,
+		struct bt_gatt_notify_params *);
+FAKE_VALUE_FUNC(ssize_t, bt_gatt_attr_read, struct bt_conn *,
+		const struct bt_gatt_attr *, void *, uint16_t, uint16_t,
+		const void *, uint16_t);
+
+#define TEST_ADC      DEVICE_DT_GET(DT_NODELABEL(adc0))
+#define TEST_CHANNEL  BATTERY_CHANNEL
+#define TEST_MV       1000
+#define TEST_RATE     1000
+/* 23-byte ATT MTU: 20-byte notifications, 9 samples each */
+#define TEST_MTU      23
+#define FRAME_SAMPLES 9
+#define FRAMES_MAX    16
+
+/* Notification recorded by the Bluetooth stack replacement */
+typedef struct {
+	uint16_t index; // Index of the first sample, or count at the end
+	size_t samples; // 0 for the end notification
+	bool captured;	// The capture had completed when it was sent
+} frame_t;
+
+static uint8_t conn_placeholder;
+#define TEST_CONN ((struct bt_conn *)&conn_placeholder)
+
+static struct k_poll_signal capture_signal;
+static sampler_burst_t requested;
+
+/* Written from the ADC thread, read once the capture completed */
+static size_t progress_count;
+static bool progress_in_order;
+static bool progress_stored;
+
+/* Written from the system work queue, read once the stream ended */
+static frame_t frames[FRAMES_MAX];
+static size_t frame_count;
+static int32_t streamed_mv[CONFIG_LIONK_BURST_MAX_SAMPLES];
+K_SEM_DEFINE(stream_end, 0, 1);
+
+/**
+ * @brief Checks the progress reported by the ADC driver
+ * 
+ * Each sample must be reported once, in order, after it was stored. The
+ * call is then forwarded to the burst module.
+ * 
+ * @param dev ADC device
+ * @param sequence Running sequence
+ * @param sampling_index Index of the sample just stored
+ * @return Action returned by the burst module
+ */
+static enum adc_action count_progress(const struct device *dev,
+				      const struct adc_sequence *sequence,
+				      uint16_t sampling_index)
+{
+	if (sampling_index != progress_count) {
+		progress_in_order = false;
+	}
+	if (requested.buffer[sampling_index] == 0) {
+		progress_stored = false;
+	}
+	progress_count++;
+	return requested.progress(dev, sequence, sampling_index);
+}
+
+/**
+ * @brief Starts the burst right away, in place of the sampler
+ * 
+ * @param new_burst Burst to capture, copied
+ * @return 0 if the capture started, negative error code otherwise
+ */
+int sampler_request_burst(const sampler_burst_t *new_burst)
+{
+	requested = *new_burst;
+	k_poll_signal_reset(&capture_signal);
+	return lionk_adc_read_burst_async(
+		new_burst->channel, new_burst->interval_us, new_burst->buffer,
+		new_burst->count, count_progress, &capture_signal);
+}
+
+/* The test connection is not reference counted */
+static struct bt_conn *conn_ref(struct bt_conn *conn)
+{
+	return conn;
+}
+
+/**
+ * @brief Records a notification of the burst data characteristic
+ * 
+ * @param conn BLE connection handle (unused)
+ * @param params Notified attribute and value
+ * @return 0
+ */
+static int record_notification(struct bt_conn *conn,
+			       struct bt_gatt_notify_params *params)
+{
+	const uint8_t *data = params->data;
+
+	if (frame_count == ARRAY_SIZE(frames)) {
+		return -EIO;
+	}
+
+	frame_t *frame = &frames[frame_count++];
+
+	frame->index = sys_get_be16(data);
+	frame->samples = (params->len - BURST_HEADER_SIZE) / BURST_SAMPLE_SIZE;
+	frame->captured = atomic_test_bit(burst_flags, BURST_CAPTURED);
+	for (size_t i = 0; i < frame->samples; i++) {
+		streamed_mv[frame->index + i] = (int16_t)sys_get_be16(
+			&data[BURST_HEADER_SIZE + i * BURST_SAMPLE_SIZE]);
+	}
+	if (frame->samples == 0) {
+		k_sem_give(&stream_end);
+	}
+	return 0;
+}
+
+/**
+ * @brief Requests a burst of the test channel, then streams it to its end
+ * 
+ * @param count Number of samples
+ */
+static void run_burst(uint16_t count)
+{
+	uint8_t request[BURST_REQUEST_SIZE] = { TEST_CHANNEL };
+	struct k_poll_event event = K_POLL_EVENT_INITIALIZER(
+		K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &capture_signal);
+	unsigned int signaled;
+	int result;
+
+	sys_put_be16(TEST_RATE, &request[1]);
+	sys_put_be16(count, &request[3]);
+	zassert_equal(write_control(TEST_CONN, &burst_svc.attrs[2], request,
+				    sizeof(request), 0, 0),
+		      sizeof(request));
+
+	zassert_ok(k_poll(&event, 1, K_SECONDS(5)));
+	k_poll_signal_check(&capture_signal, &signaled, &result);
+	zassert_ok(result);
+	requested.done(result);
+	zassert_ok(k_sem_take(&stream_end, K_SECONDS(1)));
+}
+
+static void *burst_setup(void)
+{
+	lionk_adc_setup_all();
+	zassert_ok(adc_emul_const_value_set(TEST_ADC, TEST_CHANNEL, TEST_MV));
+	k_poll_signal_init(&capture_signal);
+	return NULL;
+}
+
+static void burst_before(void *fixture)
+{
+	RESET_FAKE(ble_request_throughput);
+	RESET_FAKE(ble_release_throughput);
+	RESET_FAKE(bt_conn_ref);
+	RESET_FAKE(bt_conn_unref);
+	RESET_FAKE(bt_gatt_get_mtu);
+	RESET_FAKE(bt_gatt_is_subscribed);
+	RESET_FAKE(bt_gatt_notify_cb);
+	bt_conn_ref_fake.custom_fake = conn_ref;
+	bt_gatt_get_mtu_fake.return_val = TEST_MTU;
+	bt_gatt_is_subscribed_fake.return_val = true;
+	bt_gatt_notify_cb_fake.custom_fake = record_notification;
+
+	memset(samples, 0, sizeof(samples));
+	progress_count = 0;
+	progress_in_order = true;
+	progress_stored = true;
+	frame_count = 0;
+	k_sem_reset(&stream_end);
+}
+
+ZTEST_SUITE(burst, NULL, burst_setup, burst_before, NULL, NULL);
+
+ZTEST(burst, test_progress_every_sample)
+{
+	run_burst(40);
+
+	zassert_equal(progress_count, 40);
+	zassert_true(progress_in_order, "Samples reported out of order");
+	zassert_true(progress_stored, "Sample reported before it was stored");
+}
+
+ZTEST(burst, test_frames_split_at_mtu)
+{
+	run_burst(40);
+
+	/* 4 full frames while capturing, the 4 last samples, then the end */
+	zassert_equal(frame_count, 6);
+	for (size_t i = 0; i < 4; i++) {
+		zassert_equal(frames[i].index, i * FRAME_SAMPLES);
+		zassert_equal(frames[i].samples, FRAME_SAMPLES);
+	}
+	zassert_false(frames[0].captured, "Nothing sent during the capture");
+	zassert_equal(frames[4].index, 36);
+	zassert_equal(frames[4].samples, 4);
+	zassert_true(frames[4].captured, "Partial frame sent too early");
+	zassert_equal(frames[5].index, 40);
+	for (size_t i = 0; i < 40; i++) {
+		zassert_within(streamed_mv[i], TEST_MV, 2, "Sample %zu: %d mV",
+			       i, streamed_mv[i]);
+	}
+	zassert_equal(ble_request_throughput_fake.call_count, 1);
+	zassert_equal(ble_release_throughput_fake.call_count, 1);
+	zassert_equal(bt_conn_unref_fake.call_count, 1);
+}
+
+ZTEST(burst, test_no_empty_frame)
+{
+	run_burst(4 * FRAME_SAMPLES);
+
+	/* Full frames only, then the end */
+	zassert_equal(frame_count, 5);
+	zassert_equal(frames[3].index, 3 * FRAME_SAMPLES);
+	zassert_equal(frames[3].samples, FRAME_SAMPLES);
+	zassert_equal(frames[4].index, 4 * FRAME_SAMPLES);
+	zassert_equal(frames[4].samples, 0);
+}
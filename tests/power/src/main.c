@@ -0,0 +1,113 @@
+/*
+ * Runs the sampler on the emulated ADC and GPIO controller, and checks
+ * that every sampling cycle resumes each sampling device once and leaves
+ * it suspended.
+ */
+#include "power.h"
+#include "sampler.h"
+
+#include <zephyr/drivers/adc/adc_emul.h>
+#include <zephyr/fff.h>
+#include <zephyr/pm/device.h>
+#include <zephyr/pm/device_runtime.h>
+#include <zephyr/ztest.h>
+
+DEFINE_FFF_GLOBALS;
+
+/* The power statistics characteristic is not read here */
+FAKE_VALUE_FUNC(ssize_t, bt_gatt_attr_read, struct bt_conn *,
+		const struct bt_gatt_attr *, void *, uint16_t, uint16_t,
+		const void *, uint16_t);
+
+#define TEST_CYCLES 6
+
+/* Sampling devices, in the order of power_get_stats() */
+static const struct device *const devices[] = {
+	DEVICE_DT_GET(DT_NODELABEL(adc0)),
+	DEVICE_DT_GET(DT_NODELABEL(gpio0)),
+};
+
+/* State of the sampling devices at the end of a cycle */
+typedef struct {
+	int err;
+	size_t device_count;
+	power_stats_t stats[POWER_DEVICE_MAX];
+	bool suspended; // Every managed device is released and suspended
+} cycle_t;
+
+/* Written from the system work queue, read once the cycles are done */
+static cycle_t cycles[TEST_CYCLES];
+static size_t cycle_count;
+K_SEM_DEFINE(cycles_done, 0, 1);
+
+/**
+ * @brief Takes a snapshot of the sampling devices at the end of a cycle
+ * 
+ * Runs on the system work queue, after the sampler suspended the devices
+ * and before the next cycle can start.
+ * 
+ * @param err 0 on success, negative error code if the conversion failed
+ * @param channel Index of the channel in the zephyr,user io-channels
+ * @param value_mv Millivolt value of the channel (unused)
+ */
+static void cycle_done(int err, size_t channel, int32_t value_mv)
+{
+	if (cycle_count == ARRAY_SIZE(cycles)) {
+		return;
+	}
+
+	cycle_t *cycle = &cycles[cycle_count++];
+
+	cycle->err = err;
+	cycle->device_count =
+		power_get_stats(cycle->stats, ARRAY_SIZE(cycle->stats));
+	cycle->suspended = true;
+	for (size_t i = 0; i < ARRAY_SIZE(devices); i++) {
+		enum pm_device_state state;
+
+		if (!pm_device_runtime_is_enabled(devices[i])) {
+			continue;
+		}
+		if (pm_device_runtime_usage(devices[i]) != 0 ||
+		    pm_device_state_get(devices[i], &state) != 0 ||
+		    state != PM_DEVICE_STATE_SUSPENDED) {
+			cycle->suspended = false;
+		}
+	}
+
+	if (cycle_count == ARRAY_SIZE(cycles)) {
+		k_sem_give(&cycles_done);
+	}
+}
+
+static void *power_setup(void)
+{
+	zassert_ok(adc_emul_const_value_set(devices[0], 0, 1000));
+	zassert_ok(adc_emul_const_value_set(devices[0], 1, 2000));
+	zassert_ok(sampler_init(cycle_done));
+	return NULL;
+}
+
+ZTEST_SUITE(power, NULL, power_setup, NULL, NULL, NULL);
+
+ZTEST(power, test_cycles_balance_resume_and_suspend)
+{
+	sampler_start();
+	zassert_ok(k_sem_take(&cycles_done, K_SECONDS(2)));
+
+	for (size_t i = 0; i < ARRAY_SIZE(cycles); i++) {
+		const cycle_t *cycle = &cycles[i];
+
+		zassert_ok(cycle->err, "Cycle %zu failed", i);
+		zassert_true(cycle->suspended, "Cycle %zu left a device on", i);
+		zassert_equal(cycle->device_count, ARRAY_SIZE(devices));
+		for (size_t j = 0; j < cycle->device_count; j++) {
+			zassert_equal_ptr(cycle->stats[j].name,
+					  devices[j]->name);
+			zassert_equal(cycle->stats[j].resumes, i + 1,
+				      "%s resumed %u times in %zu cycles",
+				      cycle->stats[j].name,
+				      cycle->stats[j].resumes, i + 1);
+		}
+	}
+}